@@ -0,0 +1,337 @@
+#define _POSIX_C_SOURCE 200809L
+// Benchmark of the compute kernels and of the chunk pool, without a display.
+// Every canonical view is cut into BENCH_CHUNKS_ACROSS^2 chunks of the size
+// the application uses and computed
+//  - chunk by chunk on this thread, for pixels/s, iterations/s and the
+//    latency of single chunks,
+//  - through the worker pool with 1, 2, 4, ... threads, for the scaling.
+// Each row kernel runs in a child process of its own, as the kernel is
+// picked once per process (MANDELBROT_KERNEL). Results are printed as one
+// JSON object per line, see README.md.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mandelbrot.h"
+#include "pool.h"
+#include "perturbation.h"
+#include "depth.h"
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+#define BENCH_CHUNK_PX 50       // as CHUNK_WIDTH_PX in main.c
+#define BENCH_CHUNKS_ACROSS 8
+#define BENCH_CHUNK_COUNT (BENCH_CHUNKS_ACROSS * BENCH_CHUNKS_ACROSS)
+#define BENCH_REPEAT 3
+
+// Iteration limit of every view when -d is given. Otherwise each view gets
+// depth_for_width() of its width: fixed per view, not adaptive, so runs of
+// different versions compare, and deep enough that deep views escape
+static int bench_depth_forced = 0;
+
+struct bench_view {
+    const char *name;
+    const char *re;
+    const char *im;
+    double width;
+    int interior;           // meant to be inside the set, no pixel escapes
+};
+
+static const struct bench_view bench_views[] = {
+    { "full", "-0.6", "0", 2.4, 0 },
+    { "seahorse", "-0.75", "0.1", 0.05, 0 },
+    { "interior", "-0.1226", "0.7449", 0.06, 1 },    // inside the period-3 bulb
+    { "deep", "-0.743643887037158704752191506114774", "0.131825904205311970493132056385139", 1e-12, 0 },
+};
+#define BENCH_VIEW_COUNT (int)(sizeof(bench_views) / sizeof(bench_views[0]))
+
+// Row kernels, plus "point": compute_mandelbrot() called for every pixel
+static const char *bench_kernels[] = { "avx512", "avx2", "sse2", "scalar", "point" };
+#define BENCH_KERNEL_COUNT (int)(sizeof(bench_kernels) / sizeof(bench_kernels[0]))
+
+// Chunks of a view, ready to compute
+struct bench_chunks {
+    double pos[BENCH_CHUNK_COUNT][2];   // relative to the reference, if any
+    double size[2];
+    struct reference_orbit *reference;
+    int depth;          // iteration limit
+    double iterations;  // of a plain escape-time loop over every pixel
+};
+
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+// Nearest rank
+static double percentile(const double *sorted, int count, double p) {
+    int rank = (int)ceil(p / 100.0 * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Iterations the escape-time loop of the kernels takes at c, without any of
+// their shortcuts; the work the kernels are measured against
+static int escape_iterations(long double x, long double xi, int depth) {
+    long double z = 0.0;
+    long double zi = 0.0;
+    for (int i = 1; i < depth; i++) {
+        long double zprev = z;
+        z = z * z - zi * zi;
+        zi = 2 * zprev * zi;
+        if (z * z + zi * zi >= MANDELBROT_BAILOUT) {
+            return i;
+        }
+        z += x;
+        zi += xi;
+    }
+    return depth - 1;
+}
+
+static int bench_view_depth(const struct bench_view *view) {
+    return bench_depth_forced ? bench_depth_forced : depth_for_width(view->width);
+}
+
+static void bench_chunks_init(struct bench_chunks *chunks, const struct bench_view *view, double iterations) {
+    struct bignum centre[2];
+    bignum_from_string(&centre[0], view->re, BIGNUM_MAX_LIMBS);
+    bignum_from_string(&centre[1], view->im, BIGNUM_MAX_LIMBS);
+    long double centre_ld[2] = { strtold(view->re, NULL), strtold(view->im, NULL) };
+    double side = view->width / BENCH_CHUNKS_ACROSS;
+    double step = side / BENCH_CHUNK_PX;
+    chunks->depth = bench_view_depth(view);
+    chunks->iterations = iterations;
+    chunks->size[0] = side;
+    chunks->size[1] = side;
+    double view_pos[2] = { (double)centre_ld[0] - view->width / 2, (double)centre_ld[1] + view->width / 2 };
+    double view_size[2] = { view->width, view->width };
+    int view_px = BENCH_CHUNKS_ACROSS * BENCH_CHUNK_PX;
+    chunks->reference = NULL;
+    if (perturbation_needed(view_pos, view_size, view_px, view_px)) {
+        chunks->reference = reference_orbit_create(centre, bignum_limbs_for_step(step), chunks->depth);
+        reference_orbit_approximate(chunks->reference, view->width / sqrt(2.0), step);
+    }
+    for (int c = 0; c < BENCH_CHUNK_COUNT; c++) {
+        double offset[2] = { -view->width / 2 + (c % BENCH_CHUNKS_ACROSS) * side, view->width / 2 - (c / BENCH_CHUNKS_ACROSS) * side };
+        chunks->pos[c][0] = offset[0] + (chunks->reference ? 0.0 : (double)centre_ld[0]);
+        chunks->pos[c][1] = offset[1] + (chunks->reference ? 0.0 : (double)centre_ld[1]);
+    }
+}
+
+// Also counts the pixels that escape within the limit
+static double bench_iterations(const struct bench_view *view, long *escaped) {
+    long double centre_ld[2] = { strtold(view->re, NULL), strtold(view->im, NULL) };
+    int view_px = BENCH_CHUNKS_ACROSS * BENCH_CHUNK_PX;
+    double step = view->width / view_px;
+    int depth = bench_view_depth(view);
+    double iterations = 0.0;
+    *escaped = 0;
+    for (int i = 0; i < view_px; i++) {
+        for (int j = 0; j < view_px; j++) {
+            int n = escape_iterations(centre_ld[0] + (-view->width / 2 + (j + 0.5) * step),
+                    centre_ld[1] + (view->width / 2 - (i + 0.5) * step), depth);
+            iterations += n;
+            *escaped += n < depth - 1;
+        }
+    }
+    return iterations;
+}
+
+static void bench_compute(const struct bench_chunks *chunks, int c, const char *kernel, float *pixels) {
+    if (strcmp(kernel, "point") == 0) {
+        // The pixel centres of compute_mandelbrot_chunk
+        double step = chunks->size[0] / BENCH_CHUNK_PX;
+        for (int i = 0; i < BENCH_CHUNK_PX; i++) {
+            for (int j = 0; j < BENCH_CHUNK_PX; j++) {
+                pixels[i * BENCH_CHUNK_PX + j] = compute_mandelbrot(chunks->pos[c][0] + (j + 0.5) * step, chunks->pos[c][1] - (i + 0.5) * step, chunks->depth);
+            }
+        }
+    } else if (chunks->reference) {
+        compute_mandelbrot_chunk_perturbed(chunks->reference, chunks->pos[c], chunks->size, BENCH_CHUNK_PX, BENCH_CHUNK_PX, pixels);
+    } else {
+        compute_mandelbrot_chunk(chunks->pos[c], chunks->size, BENCH_CHUNK_PX, BENCH_CHUNK_PX, chunks->depth, pixels);
+    }
+}
+
+static const char *bench_precision(const struct bench_chunks *chunks, const char *kernel) {
+    if (strcmp(kernel, "point") == 0) {
+        return mandelbrot_precision_name(PRECISION_LONG_DOUBLE);
+    }
+    if (chunks->reference) {
+        return "perturbation";
+    }
+    return mandelbrot_precision_name(mandelbrot_select_precision(chunks->pos[0], chunks->size, BENCH_CHUNK_PX, BENCH_CHUNK_PX));
+}
+
+static void bench_single(const struct bench_chunks *chunks, const char *kernel, const char *view, int repeat) {
+    double *latency = (double*)malloc(repeat * BENCH_CHUNK_COUNT * sizeof(latency[0]));
+    float pixels[BENCH_CHUNK_PX * BENCH_CHUNK_PX];
+    double total = 0.0;
+    for (int r = 0; r < repeat; r++) {
+        for (int c = 0; c < BENCH_CHUNK_COUNT; c++) {
+            double start = now_seconds();
+            bench_compute(chunks, c, kernel, pixels);
+            latency[r * BENCH_CHUNK_COUNT + c] = now_seconds() - start;
+            total += latency[r * BENCH_CHUNK_COUNT + c];
+        }
+    }
+    int count = repeat * BENCH_CHUNK_COUNT;
+    qsort(latency, count, sizeof(latency[0]), compare_double);
+    double seconds = total / repeat;
+    double pixels_total = (double)BENCH_CHUNK_COUNT * BENCH_CHUNK_PX * BENCH_CHUNK_PX;
+    printf("{\"type\":\"single\",\"kernel\":\"%s\",\"view\":\"%s\",\"depth\":%d,\"precision\":\"%s\",\"pixels\":%.0f,\"iterations\":%.0f,"
+            "\"seconds\":%.6f,\"pixels_per_s\":%.0f,\"iterations_per_s\":%.0f,"
+            "\"chunk_us_p50\":%.1f,\"chunk_us_p90\":%.1f,\"chunk_us_p99\":%.1f,\"chunk_us_max\":%.1f}\n",
+            kernel, view, chunks->depth, bench_precision(chunks, kernel),
+            pixels_total, chunks->iterations, seconds, pixels_total / seconds, chunks->iterations / seconds,
+            percentile(latency, count, 50) * 1e6, percentile(latency, count, 90) * 1e6,
+            percentile(latency, count, 99) * 1e6, latency[count - 1] * 1e6);
+    free(latency);
+}
+
+// All chunks through a pool of `threads` workers, best of `repeat`
+static double bench_pool(const struct bench_chunks *chunks, int threads, int repeat) {
+    struct chunk_pool *pool = chunk_pool_create(threads);
+    struct tile_key key = { 0, 0, 0, 0, chunks->depth };
+    double best = INFINITY;
+    for (int r = 0; r < repeat; r++) {
+        double start = now_seconds();
+        for (int c = 0; c < BENCH_CHUNK_COUNT; c++) {
+            struct chunk_job *job = chunk_job_create(chunks->pos[c], chunks->size, BENCH_CHUNK_PX, BENCH_CHUNK_PX, &key,
+                    chunk_pool_generation(pool), chunks->reference);
+            job->depth = chunks->depth;
+            chunk_pool_submit(pool, job);
+        }
+        for (int c = 0; c < BENCH_CHUNK_COUNT; c++) {
+            chunk_job_free(chunk_pool_wait(pool));
+        }
+        best = fmin(best, now_seconds() - start);
+    }
+    chunk_pool_destroy(pool);
+    return best;
+}
+
+static void bench_kernel(const double *iterations, const char *kernel, int max_threads, int repeat) {
+    int row_kernel = strcmp(kernel, "point") != 0;
+    if (row_kernel && strcmp(mandelbrot_kernel_name(), kernel) != 0) {
+        return; // not supported here, another kernel was picked
+    }
+    struct bench_chunks views[BENCH_VIEW_COUNT];
+    for (int v = 0; v < BENCH_VIEW_COUNT; v++) {
+        bench_chunks_init(&views[v], &bench_views[v], iterations[v]);
+    }
+    for (int v = 0; v < BENCH_VIEW_COUNT; v++) {
+        if (!row_kernel && views[v].reference) {
+            continue; // long double cannot resolve it
+        }
+        bench_single(&views[v], kernel, bench_views[v].name, repeat);
+        fflush(stdout);
+        if (!row_kernel) {
+            continue;
+        }
+        double pixels_total = (double)BENCH_CHUNK_COUNT * BENCH_CHUNK_PX * BENCH_CHUNK_PX;
+        double base = 0.0;
+        for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+            double seconds = bench_pool(&views[v], threads, repeat);
+            if (threads == 1) {
+                base = seconds;
+            }
+            printf("{\"type\":\"scaling\",\"kernel\":\"%s\",\"view\":\"%s\",\"threads\":%d,\"seconds\":%.6f,\"pixels_per_s\":%.0f,\"speedup\":%.2f}\n",
+                    kernel, bench_views[v].name, threads, seconds, pixels_total / seconds, base / seconds);
+            fflush(stdout);
+            if (threads >= max_threads) {
+                break;
+            }
+        }
+    }
+    for (int v = 0; v < BENCH_VIEW_COUNT; v++) {
+        if (views[v].reference) {
+            reference_orbit_release(views[v].reference);
+        }
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int repeat = BENCH_REPEAT;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = cores > 0 ? (int)cores : 1;
+    const char *only = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:j:k:d:h")) != -1) {
+        switch (opt) {
+        case 'r': repeat = atoi(optarg); break;
+        case 'j': max_threads = atoi(optarg); break;
+        case 'k': only = optarg; break;
+        case 'd': bench_depth_forced = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-r REPEAT] [-j MAX_THREADS] [-k KERNEL] [-d DEPTH]\n"
+                    "  -d  iteration limit of every view, instead of one per view from its width\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (repeat <= 0 || max_threads <= 0 || bench_depth_forced < 0 || bench_depth_forced == 1) {
+        fprintf(stderr, "repeat, thread count and depth must be positive\n");
+        return 1;
+    }
+    int known = !only;
+    for (int k = 0; k < BENCH_KERNEL_COUNT && !known; k++) {
+        known = strcmp(only, bench_kernels[k]) == 0;
+    }
+    if (!known) {
+        fprintf(stderr, "unknown kernel '%s'\n", only);
+        return 1;
+    }
+    printf("{\"type\":\"run\",\"version\":\"%s\",\"depth\":%d,\"cores\":%ld,\"chunk_px\":%d,\"chunks\":%d,\"repeat\":%d}\n",
+            BENCH_VERSION, bench_depth_forced, cores, BENCH_CHUNK_PX, BENCH_CHUNK_COUNT, repeat);
+    fflush(stdout);
+
+    // The reference work is counted once, the children inherit it. Nothing
+    // here may touch the kernel selection, each child makes its own.
+    double iterations[BENCH_VIEW_COUNT];
+    for (int v = 0; v < BENCH_VIEW_COUNT; v++) {
+        long escaped;
+        iterations[v] = bench_iterations(&bench_views[v], &escaped);
+        // A view that never escapes only measures the interior shortcuts
+        if (escaped == 0 && !bench_views[v].interior) {
+            fprintf(stderr, "view %s is entirely inside the set at %d iterations\n",
+                    bench_views[v].name, bench_view_depth(&bench_views[v]));
+            return 1;
+        }
+    }
+    int status = 0;
+    for (int k = 0; k < BENCH_KERNEL_COUNT; k++) {
+        if (only && strcmp(only, bench_kernels[k]) != 0) {
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (strcmp(bench_kernels[k], "point") != 0) {
+                setenv("MANDELBROT_KERNEL", bench_kernels[k], 1);
+            }
+            bench_kernel(iterations, bench_kernels[k], max_threads, repeat);
+            fflush(stdout);
+            _exit(0);
+        }
+        int child;
+        if (pid < 0 || waitpid(pid, &child, 0) != pid || !WIFEXITED(child) || WEXITSTATUS(child) != 0) {
+            fprintf(stderr, "kernel %s failed\n", bench_kernels[k]);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,219 @@
+#include "bignum.h"
+
+#include <string.h>
+#include <math.h>
+
+int bignum_limbs_for_step(double step) {
+    // Enough fractional bits for the step itself, plus two limbs of guard
+    int bits = (int)ceil(-log2(step));
+    int limbs = (bits > 0 ? bits : 0) / 32 + 3;
+    return limbs < BIGNUM_MAX_LIMBS ? limbs : BIGNUM_MAX_LIMBS;
+}
+
+static int bignum_is_zero(const struct bignum *a, int limbs) {
+    for (int i = 0; i < limbs; i++) {
+        if (a->limb[i]) return 0;
+    }
+    return 1;
+}
+
+static int bignum_cmp_magnitude(const struct bignum *a, const struct bignum *b, int limbs) {
+    for (int i = 0; i < limbs; i++) {
+        if (a->limb[i] != b->limb[i]) {
+            return a->limb[i] < b->limb[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// r = |a| + |b|
+static void bignum_add_magnitude(struct bignum *r, const struct bignum *a, const struct bignum *b, int limbs) {
+    uint64_t carry = 0;
+    for (int i = limbs - 1; i >= 0; i--) {
+        uint64_t sum = (uint64_t)a->limb[i] + b->limb[i] + carry;
+        r->limb[i] = (uint32_t)sum;
+        carry = sum >> 32;
+    }
+}
+
+// r = |a| - |b|, requires |a| >= |b|
+static void bignum_sub_magnitude(struct bignum *r, const struct bignum *a, const struct bignum *b, int limbs) {
+    int64_t borrow = 0;
+    for (int i = limbs - 1; i >= 0; i--) {
+        int64_t diff = (int64_t)a->limb[i] - b->limb[i] - borrow;
+        borrow = diff < 0;
+        r->limb[i] = (uint32_t)(diff + (borrow ? ((int64_t)1 << 32) : 0));
+    }
+}
+
+void bignum_add(struct bignum *r, const struct bignum *a, const struct bignum *b, int limbs) {
+    if (a->negative == b->negative) {
+        int negative = a->negative;
+        bignum_add_magnitude(r, a, b, limbs);
+        r->negative = negative;
+    } else if (bignum_cmp_magnitude(a, b, limbs) >= 0) {
+        int negative = a->negative;
+        bignum_sub_magnitude(r, a, b, limbs);
+        r->negative = negative;
+    } else {
+        int negative = b->negative;
+        bignum_sub_magnitude(r, b, a, limbs);
+        r->negative = negative;
+    }
+    if (bignum_is_zero(r, limbs)) {
+        r->negative = 0;
+    }
+}
+
+void bignum_sub(struct bignum *r, const struct bignum *a, const struct bignum *b, int limbs) {
+    struct bignum nb = *b;
+    nb.negative = !b->negative;
+    bignum_add(r, a, &nb, limbs);
+}
+
+void bignum_mul(struct bignum *r, const struct bignum *a, const struct bignum *b, int limbs) {
+    // Column sums of 32 bit halves; a column collects at most 2 * limbs
+    // values below 2^32, so uint64_t cannot overflow. One extra column keeps
+    // the carries from the truncated tail.
+    uint64_t column[BIGNUM_MAX_LIMBS + 1] = { 0 };
+    for (int i = 0; i < limbs; i++) {
+        if (!a->limb[i]) continue;
+        for (int j = 0; j < limbs && i + j <= limbs; j++) {
+            uint64_t p = (uint64_t)a->limb[i] * b->limb[j];
+            // p * 2^(-32 (i + j)): the high half is one column more significant
+            column[i + j] += p & 0xffffffffu;
+            if (i + j > 0) {
+                column[i + j - 1] += p >> 32;
+            }
+        }
+    }
+    uint64_t carry = 0;
+    for (int k = limbs; k >= 0; k--) {
+        uint64_t sum = column[k] + carry;
+        if (k < limbs) {
+            r->limb[k] = (uint32_t)sum;
+        }
+        carry = sum >> 32;
+    }
+    r->negative = a->negative != b->negative && !bignum_is_zero(r, limbs);
+}
+
+void bignum_from_double(struct bignum *r, double x) {
+    memset(r, 0, sizeof(*r));
+    r->negative = x < 0;
+    x = fabs(x);
+    double integer = floor(x);
+    r->limb[0] = (uint32_t)integer;
+    x -= integer;
+    // A double has 53 significant bits, it runs out long before the limbs
+    for (int i = 1; i < BIGNUM_MAX_LIMBS && x != 0.0; i++) {
+        x = ldexp(x, 32);
+        integer = floor(x);
+        r->limb[i] = (uint32_t)integer;
+        x -= integer;
+    }
+}
+
+double bignum_to_double(const struct bignum *a, int limbs) {
+    double x = 0.0;
+    for (int i = limbs - 1; i >= 0; i--) {
+        x += ldexp((double)a->limb[i], -32 * i);
+    }
+    return a->negative ? -x : x;
+}
+
+void bignum_add_double(struct bignum *r, const struct bignum *a, double x, int limbs) {
+    struct bignum b;
+    bignum_from_double(&b, x);
+    bignum_add(r, a, &b, limbs);
+}
+
+void bignum_truncate(struct bignum *r, const struct bignum *a, int frac_bits) {
+    *r = *a;
+    // limb[whole] is the last one kept entirely, limb[whole + 1] keeps `rest` bits
+    int whole = frac_bits / 32;
+    int rest = frac_bits % 32;
+    for (int i = whole + 1; i < BIGNUM_MAX_LIMBS; i++) {
+        r->limb[i] = i == whole + 1 && rest ? r->limb[i] & ~(0xffffffffu >> rest) : 0;
+    }
+    if (bignum_is_zero(r, BIGNUM_MAX_LIMBS)) {
+        r->negative = 0;
+    }
+}
+
+uint64_t bignum_hash(const struct bignum *a, uint64_t seed) {
+    uint64_t h = seed ^ (uint64_t)a->negative;
+    h *= 0x100000001b3ull;
+    for (int i = 0; i < BIGNUM_MAX_LIMBS; i++) {
+        for (int k = 0; k < 32; k += 8) {
+            h ^= (a->limb[i] >> k) & 0xff;
+            h *= 0x100000001b3ull;
+        }
+    }
+    return h;
+}
+
+int bignum_from_string(struct bignum *r, const char *s, int limbs) {
+    memset(r, 0, sizeof(*r));
+    int negative = 0;
+    if (*s == '-' || *s == '+') {
+        negative = *s == '-';
+        s++;
+    }
+    uint64_t integer = 0;
+    for (; *s >= '0' && *s <= '9'; s++) {
+        integer = integer * 10 + (*s - '0');
+        if (integer > UINT32_MAX) return 1;
+    }
+    if (*s == '.') {
+        s++;
+        const char *digits = s;
+        while (*s >= '0' && *s <= '9') s++;
+        // Horner from the last digit: frac = (digit + frac) / 10
+        for (const char *d = s - 1; d >= digits; d--) {
+            r->limb[0] = (uint32_t)(*d - '0');
+            uint64_t rem = 0;
+            for (int i = 0; i < limbs; i++) {
+                uint64_t cur = (rem << 32) | r->limb[i];
+                r->limb[i] = (uint32_t)(cur / 10);
+                rem = cur % 10;
+            }
+        }
+    }
+    if (*s != '\0') return 1;
+    r->limb[0] = (uint32_t)integer;
+    r->negative = negative && !bignum_is_zero(r, limbs);
+    return 0;
+}
+
+void bignum_to_string(const struct bignum *a, int limbs, int digits, char *buf, int buf_len) {
+    struct bignum frac = *a;
+    int n = 0;
+    // "-", up to 10 integer digits, "." and the terminator
+    if (buf_len < digits + 13) {
+        digits = buf_len - 13 > 0 ? buf_len - 13 : 0;
+    }
+    if (a->negative) buf[n++] = '-';
+    char integer[11];
+    int len = 0;
+    uint32_t value = frac.limb[0];
+    do {
+        integer[len++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (len) buf[n++] = integer[--len];
+    buf[n++] = '.';
+    frac.limb[0] = 0;
+    for (int k = 0; k < digits; k++) {
+        // frac *= 10, the overflow into limb[0] is the next digit
+        uint64_t carry = 0;
+        for (int i = limbs - 1; i >= 0; i--) {
+            uint64_t cur = (uint64_t)frac.limb[i] * 10 + carry;
+            frac.limb[i] = (uint32_t)cur;
+            carry = cur >> 32;
+        }
+        buf[n++] = (char)('0' + frac.limb[0]);
+        frac.limb[0] = 0;
+    }
+    buf[n] = '\0';
+}
@@ -0,0 +1,38 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stdint.h>
+
+// Signed fixed-point numbers for deep zoom coordinates.
+// limb[0] is the integer part, limb[i] holds the bits 2^(-32 i) .. 2^(-32 i - 31).
+// Every operation takes the number of limbs in use, so shallow views don't
+// pay for BIGNUM_MAX_LIMBS of precision. Results are truncated, not rounded.
+
+#define BIGNUM_MAX_LIMBS 40 // 1248 fractional bits, far beyond a double delta
+
+struct bignum {
+    int negative;
+    uint32_t limb[BIGNUM_MAX_LIMBS];
+};
+
+// Limbs needed to address pixels of size `step` with some bits to spare
+int bignum_limbs_for_step(double step);
+
+void bignum_from_double(struct bignum *r, double x);
+double bignum_to_double(const struct bignum *a, int limbs);
+// Parses a decimal number ("-0.7436438870371587...", no exponent).
+// Returns 0 on success.
+int bignum_from_string(struct bignum *r, const char *s, int limbs);
+// Writes `digits` decimal digits after the point
+void bignum_to_string(const struct bignum *a, int limbs, int digits, char *buf, int buf_len);
+
+void bignum_add(struct bignum *r, const struct bignum *a, const struct bignum *b, int limbs);
+void bignum_sub(struct bignum *r, const struct bignum *a, const struct bignum *b, int limbs);
+void bignum_mul(struct bignum *r, const struct bignum *a, const struct bignum *b, int limbs);
+void bignum_add_double(struct bignum *r, const struct bignum *a, double x, int limbs);
+// Drops every bit below 2^(-frac_bits), frac_bits >= 0, towards zero
+void bignum_truncate(struct bignum *r, const struct bignum *a, int frac_bits);
+// FNV-1a over sign and limbs, chained through `seed`
+uint64_t bignum_hash(const struct bignum *a, uint64_t seed);
+
+#endif
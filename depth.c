@@ -0,0 +1,79 @@
+#include "depth.h"
+#include "mandelbrot.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+static int depth_clamp(double depth) {
+    int rounded = (int)ceil(depth / DEPTH_PER_OCTAVE) * DEPTH_PER_OCTAVE;
+    return rounded < DEPTH_BASE ? DEPTH_BASE : rounded > MANDELBROT_DEPTH_MAX ? MANDELBROT_DEPTH_MAX : rounded;
+}
+
+int depth_for_width(double width) {
+    double octaves = log2(DEPTH_WHOLE_WIDTH / width);
+    return depth_clamp(DEPTH_BASE + DEPTH_PER_OCTAVE * fmax(octaves, 0.0));
+}
+
+int depth_control_at(const struct depth_control *control, double width) {
+    return control->forced ? control->forced : depth_clamp((double)depth_for_width(width) * control->factor);
+}
+
+static void depth_control_reset(struct depth_control *control) {
+    control->escaped = 0;
+    control->late = 0;
+    control->max_count = 0.0;
+}
+
+// Sets the limit, and reports changes: a result is only reproducible with it
+static void depth_control_set(struct depth_control *control) {
+    int depth = control->forced ? control->forced : depth_clamp((double)control->zoom * control->factor);
+    if (depth != control->depth) {
+        fprintf(stderr, "Depth: %d iterations (%d for the zoom, x%d)\n", depth, control->zoom, control->factor);
+    }
+    control->depth = depth;
+}
+
+void depth_control_init(struct depth_control *control) {
+    control->forced = 0;
+    const char *forced = getenv("MANDELBROT_DEPTH");
+    if (forced && forced[0]) {
+        int depth = atoi(forced);
+        control->forced = depth < 1 ? 1 : depth > MANDELBROT_DEPTH_MAX ? MANDELBROT_DEPTH_MAX : depth;
+    }
+    control->factor = 1;
+    control->zoom = DEPTH_BASE;
+    control->depth = 0;
+    depth_control_reset(control);
+}
+
+int depth_control_view(struct depth_control *control, double width) {
+    if (control->escaped >= DEPTH_MIN_SAMPLES && control->factor > 1 && control->max_count < control->depth / 4) {
+        control->factor /= 2;
+    }
+    depth_control_reset(control);
+    control->zoom = depth_for_width(width);
+    depth_control_set(control);
+    return control->depth;
+}
+
+int depth_control_observe(struct depth_control *control, const float *pixels, int count) {
+    double half = control->depth / 2;
+    for (int i = 0; i < count; i++) {
+        if (pixels[i] == 0.0f) {
+            continue;
+        }
+        double mu = mandelbrot_escape_count(pixels[i]);
+        control->escaped++;
+        control->late += mu > half;
+        control->max_count = fmax(control->max_count, mu);
+    }
+    if (control->forced || control->depth >= MANDELBROT_DEPTH_MAX || control->escaped < DEPTH_MIN_SAMPLES ||
+        control->late <= DEPTH_RAISE_FRACTION * control->escaped) {
+        return 0;
+    }
+    control->factor *= 2;
+    depth_control_reset(control);
+    depth_control_set(control);
+    return 1;
+}
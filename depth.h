@@ -0,0 +1,53 @@
+#ifndef DEPTH_H
+#define DEPTH_H
+
+// Iteration limit of a view, no GL.
+// A fixed limit is too high for overviews, where it is mostly spent inside
+// the set, and too low for deep zooms, where detail escapes late. The limit
+// follows the zoom: DEPTH_BASE iterations for a view of the whole set, plus
+// DEPTH_PER_OCTAVE for every halving of the view width. On top of that a
+// learned factor (a power of two) corrects it from the escape counts of the
+// chunks computed so far:
+//  - when more than DEPTH_RAISE_FRACTION of the escaped pixels of complete
+//    chunks took more than half the limit, detail is being cut off: the
+//    factor doubles, and the caller recomputes the view
+//  - when a view ends without any escape past a quarter of the limit, the
+//    factor halves for the next view
+// The limit is clamped to [DEPTH_BASE, MANDELBROT_DEPTH_MAX] and rounded to
+// DEPTH_PER_OCTAVE, so nearby views share tiles. MANDELBROT_DEPTH=<n> in the
+// environment fixes it instead.
+
+#define DEPTH_BASE 256
+#define DEPTH_PER_OCTAVE 64
+#define DEPTH_WHOLE_WIDTH 4.0       // view width the octaves count from
+#define DEPTH_RAISE_FRACTION 0.02
+#define DEPTH_MIN_SAMPLES 4096      // escaped pixels to see before deciding
+
+struct depth_control {
+    int forced;             // fixed limit, 0 when adaptive
+    int factor;             // learned, power of two
+    int zoom;               // limit of the zoom alone
+    int depth;              // current limit
+    // Complete chunks of the current view
+    long escaped;
+    long late;              // escaped past half the limit
+    double max_count;       // highest escape count
+};
+
+// Limit for a view `width` wide from the zoom alone
+int depth_for_width(double width);
+
+// Limit the control gives a view `width` wide, with what it has learned so
+// far, without moving to it
+int depth_control_at(const struct depth_control *control, double width);
+
+void depth_control_init(struct depth_control *control);
+// A new view `width` wide: settles the factor from the previous view and
+// returns the limit
+int depth_control_view(struct depth_control *control, double width);
+// Escape values (see mandelbrot.h) of a complete chunk computed with the
+// current limit. Returns 1 when the limit was raised: the view has to be
+// computed again
+int depth_control_observe(struct depth_control *control, const float *pixels, int count);
+
+#endif
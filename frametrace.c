@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L
+#include "frametrace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *frame_stage_names[FRAME_STAGE_COUNT] = {
+    "input", "vertices", "chunks", "upload", "draw", "swap",
+};
+
+const char *frame_stage_name(int stage) {
+    return stage >= 0 && stage < FRAME_STAGE_COUNT ? frame_stage_names[stage] : "?";
+}
+
+static int64_t frame_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void frame_trace_init(struct frame_trace *trace) {
+    memset(trace, 0, sizeof(*trace));
+}
+
+void frame_trace_release(struct frame_trace *trace) {
+    free(trace->frames);
+    free(trace->spans);
+    memset(trace, 0, sizeof(*trace));
+}
+
+void frame_trace_enable(struct frame_trace *trace, int enabled) {
+    trace->requested = enabled != 0;
+}
+
+// Ends the stretch of the current stage at `now`
+static void frame_trace_close(struct frame_trace *trace, int64_t now) {
+    struct frame_record *record = &trace->frames[trace->frame % FRAME_TRACE_FRAMES];
+    record->cpu_ns[trace->stage] += now - trace->stage_start_ns;
+    struct frame_span *span = &trace->spans[trace->span++ % FRAME_TRACE_SPANS];
+    span->start_ns = trace->stage_start_ns;
+    span->end_ns = now;
+    span->stage = trace->stage;
+}
+
+void frame_trace_begin(struct frame_trace *trace) {
+    if (!trace->enabled && !trace->requested) {
+        return;
+    }
+    int64_t now = frame_trace_now();
+    if (trace->enabled) {
+        frame_trace_close(trace, now);
+        trace->frame++;
+    }
+    trace->enabled = trace->requested;
+    if (!trace->enabled) {
+        return;
+    }
+    if (!trace->frames) {
+        trace->frames = (struct frame_record*)calloc(FRAME_TRACE_FRAMES, sizeof(trace->frames[0]));
+        trace->spans = (struct frame_span*)calloc(FRAME_TRACE_SPANS, sizeof(trace->spans[0]));
+        if (!trace->frames || !trace->spans) {
+            free(trace->frames);
+            free(trace->spans);
+            trace->frames = NULL;
+            trace->spans = NULL;
+            trace->enabled = trace->requested = 0;
+            return;
+        }
+    }
+    struct frame_record *record = &trace->frames[trace->frame % FRAME_TRACE_FRAMES];
+    memset(record, 0, sizeof(*record));
+    record->frame = trace->frame;
+    record->start_ns = now;
+    for (int s = 0; s < FRAME_STAGE_COUNT; s++) {
+        record->gpu_ns[s] = -1;
+    }
+    trace->stage = FRAME_INPUT;
+    trace->stage_start_ns = now;
+}
+
+int frame_trace_stage(struct frame_trace *trace, int stage) {
+    int previous = trace->stage;
+    if (!trace->enabled || stage == previous) {
+        return previous;
+    }
+    int64_t now = frame_trace_now();
+    frame_trace_close(trace, now);
+    trace->stage = stage;
+    trace->stage_start_ns = now;
+    return previous;
+}
+
+void frame_trace_counters(struct frame_trace *trace, int chunks_done, int chunks_queued,
+        unsigned long cache_hits, unsigned long cache_misses) {
+    if (!trace->enabled) {
+        return;
+    }
+    struct frame_record *record = &trace->frames[trace->frame % FRAME_TRACE_FRAMES];
+    record->chunks_done = chunks_done;
+    record->chunks_queued = chunks_queued;
+    record->cache_hits = cache_hits;
+    record->cache_misses = cache_misses;
+}
+
+void frame_trace_gpu(struct frame_trace *trace, unsigned long frame, int stage, int64_t ns) {
+    if (!trace->frames || frame > trace->frame) {
+        return;
+    }
+    struct frame_record *record = &trace->frames[frame % FRAME_TRACE_FRAMES];
+    if (record->frame == frame) {
+        record->gpu_ns[stage] = ns;
+    }
+}
+
+// Complete frames still in the ring: [*first, trace->frame)
+static unsigned long frame_trace_first(const struct frame_trace *trace) {
+    // The slot of the current frame is in use, the one before it is the oldest
+    return trace->frame < FRAME_TRACE_FRAMES ? 0 : trace->frame - (FRAME_TRACE_FRAMES - 1);
+}
+
+int frame_trace_summary(const struct frame_trace *trace, int frames, struct frame_summary *summary) {
+    memset(summary, 0, sizeof(*summary));
+    if (!trace->frames) {
+        return 0;
+    }
+    unsigned long first = frame_trace_first(trace);
+    if (frames > 0 && trace->frame - first > (unsigned long)frames) {
+        first = trace->frame - frames;
+    }
+    if (first >= trace->frame) {
+        return 0;
+    }
+    int gpu_count[FRAME_STAGE_COUNT] = { 0 };
+    for (unsigned long f = first; f < trace->frame; f++) {
+        const struct frame_record *record = &trace->frames[f % FRAME_TRACE_FRAMES];
+        double frame_ms = 0.0;
+        for (int s = 0; s < FRAME_STAGE_COUNT; s++) {
+            summary->cpu_ms[s] += record->cpu_ns[s] * 1e-6;
+            frame_ms += record->cpu_ns[s] * 1e-6;
+            if (record->gpu_ns[s] >= 0) {
+                summary->gpu_ms[s] += record->gpu_ns[s] * 1e-6;
+                gpu_count[s]++;
+            }
+        }
+        summary->frame_ms += frame_ms;
+        if (frame_ms > summary->frame_max_ms) {
+            summary->frame_max_ms = frame_ms;
+        }
+        summary->frames++;
+    }
+    summary->frame_ms /= summary->frames;
+    for (int s = 0; s < FRAME_STAGE_COUNT; s++) {
+        summary->cpu_ms[s] /= summary->frames;
+        summary->gpu_ms[s] = gpu_count[s] ? summary->gpu_ms[s] / gpu_count[s] : -1.0;
+    }
+    const struct frame_record *oldest = &trace->frames[first % FRAME_TRACE_FRAMES];
+    const struct frame_record *newest = &trace->frames[(trace->frame - 1) % FRAME_TRACE_FRAMES];
+    summary->chunks_queued = newest->chunks_queued;
+    unsigned long hits = newest->cache_hits - oldest->cache_hits;
+    unsigned long lookups = hits + newest->cache_misses - oldest->cache_misses;
+    summary->cache_hit_rate = lookups ? (double)hits / lookups : -1.0;
+    return summary->frames;
+}
+
+int frame_trace_write(const struct frame_trace *trace, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"mandelbrot\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"render loop\"}}");
+    if (trace->frames && trace->frame > 0) {
+        unsigned long first = frame_trace_first(trace);
+        unsigned long first_span = trace->span > FRAME_TRACE_SPANS ? trace->span - FRAME_TRACE_SPANS : 0;
+        // Only frames whose spans are all still there
+        while (first < trace->frame &&
+               trace->frames[first % FRAME_TRACE_FRAMES].start_ns < trace->spans[first_span % FRAME_TRACE_SPANS].start_ns) {
+            first++;
+        }
+        int64_t origin = trace->frames[first % FRAME_TRACE_FRAMES].start_ns;
+        int64_t end = origin;
+        for (unsigned long f = first; f < trace->frame; f++) {
+            const struct frame_record *record = &trace->frames[f % FRAME_TRACE_FRAMES];
+            int64_t duration = 0;
+            for (int s = 0; s < FRAME_STAGE_COUNT; s++) {
+                duration += record->cpu_ns[s];
+            }
+            double ts = (record->start_ns - origin) * 1e-3;
+            fprintf(file, ",\n{\"name\":\"frame %lu\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                    record->frame, ts, duration * 1e-3);
+            fprintf(file, ",\n{\"name\":\"chunks\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"done\":%d,\"queued\":%d}}",
+                    ts, record->chunks_done, record->chunks_queued);
+            // GPU times are durations without a position on the GPU timeline,
+            // a counter per frame shows them next to the CPU spans
+            int gpu = 0;
+            for (int s = 0; s < FRAME_STAGE_COUNT; s++) {
+                if (record->gpu_ns[s] < 0) {
+                    continue;
+                }
+                if (!gpu++) {
+                    fprintf(file, ",\n{\"name\":\"gpu ms\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{", ts);
+                } else {
+                    fputc(',', file);
+                }
+                fprintf(file, "\"%s\":%.4f", frame_stage_name(s), record->gpu_ns[s] * 1e-6);
+            }
+            if (gpu) {
+                fprintf(file, "}}");
+            }
+            end = record->start_ns + duration;
+        }
+        for (unsigned long i = first_span; i < trace->span; i++) {
+            const struct frame_span *span = &trace->spans[i % FRAME_TRACE_SPANS];
+            if (span->start_ns < origin || span->end_ns > end) {
+                continue;
+            }
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                    frame_stage_name(span->stage), (span->start_ns - origin) * 1e-3, (span->end_ns - span->start_ns) * 1e-3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    int status = ferror(file) ? -1 : 0;
+    if (fclose(file) != 0) {
+        status = -1;
+    }
+    return status;
+}
@@ -0,0 +1,91 @@
+#ifndef FRAMETRACE_H
+#define FRAMETRACE_H
+
+#include <stdint.h>
+
+// Per-frame instrumentation of the render loop, no GL.
+// The loop is cut into stages; every stage switch is timed with the
+// monotonic clock into a ring buffer of the last FRAME_TRACE_FRAMES frames
+// (totals per stage) and FRAME_TRACE_SPANS spans (each stretch of a stage,
+// for the trace export). GPU times come from timer queries issued by the
+// caller and are filled in a few frames late, when their results arrive.
+//
+// Recording is off unless enabled; then every call is a single flag test.
+
+#define FRAME_TRACE_FRAMES 1024
+#define FRAME_TRACE_SPANS 65536
+
+enum frame_stage {
+    FRAME_INPUT,        // events and key handling
+    FRAME_VERTICES,     // chunk grid rebuild, vertex buffer upload
+    FRAME_CHUNKS,       // draining the pool: cache, tile store, next passes
+    FRAME_UPLOAD,       // texture uploads of finished chunks
+    FRAME_DRAW,
+    FRAME_SWAP,
+    FRAME_STAGE_COUNT
+};
+
+struct frame_record {
+    unsigned long frame;
+    int64_t start_ns;
+    int64_t cpu_ns[FRAME_STAGE_COUNT];
+    int64_t gpu_ns[FRAME_STAGE_COUNT];  // -1 when not measured (yet)
+    int chunks_done;        // jobs polled in the frame
+    int chunks_queued;      // jobs pending at the end of it
+    unsigned long cache_hits;   // cumulative
+    unsigned long cache_misses;
+};
+
+struct frame_span {
+    int64_t start_ns;
+    int64_t end_ns;
+    int stage;
+};
+
+struct frame_trace {
+    int enabled;
+    int requested;          // takes effect at the next frame_trace_begin
+    int stage;
+    int64_t stage_start_ns;
+    unsigned long frame;    // frames recorded so far
+    unsigned long span;     // spans recorded so far
+    struct frame_record *frames;
+    struct frame_span *spans;
+};
+
+// Averages over the last frames, for an overlay
+struct frame_summary {
+    int frames;
+    double frame_ms;
+    double frame_max_ms;
+    double cpu_ms[FRAME_STAGE_COUNT];
+    double gpu_ms[FRAME_STAGE_COUNT];   // negative when not measured
+    int chunks_queued;
+    double cache_hit_rate;  // of the lookups in those frames, negative if none
+};
+
+const char *frame_stage_name(int stage);
+
+void frame_trace_init(struct frame_trace *trace);
+void frame_trace_release(struct frame_trace *trace);
+// Start or stop recording from the next frame on
+void frame_trace_enable(struct frame_trace *trace, int enabled);
+
+// Ends the previous frame and starts a new one in FRAME_INPUT
+void frame_trace_begin(struct frame_trace *trace);
+// Switches to `stage`, returns the stage that was current, so a nested
+// stretch (an upload in the middle of another stage) can switch back
+int frame_trace_stage(struct frame_trace *trace, int stage);
+// Counters of the current frame
+void frame_trace_counters(struct frame_trace *trace, int chunks_done, int chunks_queued,
+        unsigned long cache_hits, unsigned long cache_misses);
+// GPU time of a stage of an earlier frame, ignored once it left the ring
+void frame_trace_gpu(struct frame_trace *trace, unsigned long frame, int stage, int64_t ns);
+
+// Over the last `frames` complete frames, 0 if there are none
+int frame_trace_summary(const struct frame_trace *trace, int frames, struct frame_summary *summary);
+// Chrome trace event JSON (chrome://tracing, Perfetto) of the recorded
+// frames still in the ring. Returns 0 on success
+int frame_trace_write(const struct frame_trace *trace, const char *path);
+
+#endif
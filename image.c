@@ -0,0 +1,166 @@
+#include "image.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#define PNG_STORED_BLOCK_MAX 65535
+
+struct image_writer {
+    FILE *file;
+    int width_px;
+    int height_px;
+    int rows_written;
+    int png;
+    uint32_t adler_a;   // zlib checksum of the scanlines
+    uint32_t adler_b;
+    unsigned char *scanlines; // PNG: rows with their filter byte, for one call
+    size_t scanlines_size;
+};
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const unsigned char *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void png_chunk(struct image_writer *writer, const char *type, const unsigned char *data, size_t len) {
+    unsigned char header[8];
+    put_be32(header, (uint32_t)len);
+    memcpy(header + 4, type, 4);
+    uint32_t crc = crc_update(0xffffffffu, header + 4, 4);
+    crc = crc_update(crc, data, len);
+    unsigned char trailer[4];
+    put_be32(trailer, crc ^ 0xffffffffu);
+    fwrite(header, 1, 8, writer->file);
+    if (len) {
+        fwrite(data, 1, len, writer->file);
+    }
+    fwrite(trailer, 1, 4, writer->file);
+}
+
+
+struct image_writer *image_writer_open(const char *path, int width_px, int height_px) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return NULL;
+    }
+    struct image_writer *writer = (struct image_writer*)calloc(1, sizeof(*writer));
+    writer->file = file;
+    writer->width_px = width_px;
+    writer->height_px = height_px;
+    const char *ext = strrchr(path, '.');
+    writer->png = ext && strcmp(ext, ".png") == 0;
+    if (!writer->png) {
+        fprintf(file, "P5\n%d %d\n255\n", width_px, height_px);
+        return writer;
+    }
+    crc_init();
+    writer->adler_a = 1;
+    writer->adler_b = 0;
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, 8, file);
+    unsigned char ihdr[13];
+    put_be32(ihdr, width_px);
+    put_be32(ihdr + 4, height_px);
+    ihdr[8] = 8;    // bit depth
+    ihdr[9] = 0;    // grayscale
+    ihdr[10] = 0;   // deflate
+    ihdr[11] = 0;   // adaptive filtering (every row uses "none")
+    ihdr[12] = 0;   // not interlaced
+    png_chunk(writer, "IHDR", ihdr, sizeof(ihdr));
+    // zlib stream header: deflate, 32K window, no dictionary
+    static const unsigned char zlib_header[2] = { 0x78, 0x01 };
+    png_chunk(writer, "IDAT", zlib_header, sizeof(zlib_header));
+    return writer;
+}
+
+int image_writer_rows(struct image_writer *writer, const unsigned char *rows, int count) {
+    if (count > writer->height_px - writer->rows_written) {
+        return -1;
+    }
+    writer->rows_written += count;
+    if (!writer->png) {
+        fwrite(rows, writer->width_px, count, writer->file);
+        return ferror(writer->file) ? -1 : 0;
+    }
+    // Scanlines (filter byte + row), cut into stored deflate blocks
+    size_t len = (size_t)count * (writer->width_px + 1);
+    size_t blocks = (len + PNG_STORED_BLOCK_MAX - 1) / PNG_STORED_BLOCK_MAX;
+    size_t size = len + 5 * blocks;
+    if (size > writer->scanlines_size) {
+        free(writer->scanlines);
+        writer->scanlines = (unsigned char*)malloc(size);
+        writer->scanlines_size = size;
+    }
+    unsigned char *raw = writer->scanlines + 5 * blocks; // staged behind the block headers
+    for (int i = 0; i < count; i++) {
+        raw[i * (writer->width_px + 1)] = 0;
+        memcpy(&raw[i * (writer->width_px + 1) + 1], &rows[(size_t)i * writer->width_px], writer->width_px);
+    }
+    // Adler-32; a and b stay far below 2^32 over a 5552 byte run
+    for (size_t i = 0; i < len; ) {
+        size_t run = len - i < 5552 ? len - i : 5552;
+        for (size_t k = 0; k < run; k++) {
+            writer->adler_a += raw[i + k];
+            writer->adler_b += writer->adler_a;
+        }
+        writer->adler_a %= 65521;
+        writer->adler_b %= 65521;
+        i += run;
+    }
+    unsigned char *out = writer->scanlines;
+    for (size_t i = 0; i < len; i += PNG_STORED_BLOCK_MAX) {
+        size_t block = len - i < PNG_STORED_BLOCK_MAX ? len - i : PNG_STORED_BLOCK_MAX;
+        out[0] = 0; // not the last block, stored
+        out[1] = block & 0xff;
+        out[2] = block >> 8;
+        out[3] = ~block & 0xff;
+        out[4] = (~block >> 8) & 0xff;
+        memmove(out + 5, raw + i, block);
+        out += 5 + block;
+    }
+    png_chunk(writer, "IDAT", writer->scanlines, size);
+    return ferror(writer->file) ? -1 : 0;
+}
+
+int image_writer_close(struct image_writer *writer) {
+    int status = writer->rows_written == writer->height_px ? 0 : -1;
+    if (writer->png) {
+        // Empty last block, then the checksum ends the zlib stream
+        unsigned char end[9] = { 1, 0x00, 0x00, 0xff, 0xff };
+        put_be32(end + 5, writer->adler_b << 16 | writer->adler_a);
+        png_chunk(writer, "IDAT", end, sizeof(end));
+        png_chunk(writer, "IEND", NULL, 0);
+    }
+    if (ferror(writer->file)) {
+        status = -1;
+    }
+    if (fclose(writer->file) != 0) {
+        status = -1;
+    }
+    free(writer->scanlines);
+    free(writer);
+    return status;
+}
@@ -0,0 +1,19 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+// Streaming writer for 8-bit grayscale images, for the headless renderer.
+// Rows are written top to bottom as they are ready, so an image never has
+// to be held in memory as a whole. The format follows the file extension:
+// ".png" writes a PNG (stored, i.e. uncompressed, deflate blocks, so no
+// zlib is needed), anything else a binary PGM.
+
+struct image_writer;
+
+// NULL if the file cannot be created
+struct image_writer *image_writer_open(const char *path, int width_px, int height_px);
+// `count` rows of width_px bytes each. Returns 0 on success
+int image_writer_rows(struct image_writer *writer, const unsigned char *rows, int count);
+// Finishes the file. Returns 0 if every write succeeded
+int image_writer_close(struct image_writer *writer);
+
+#endif
@@ -5,15 +5,45 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 
 #include <time.h>
 
+#include "mandelbrot.h"
+#include "pool.h"
+#include "perturbation.h"
+#include "tilecache.h"
+#include "tilestore.h"
+#include "frametrace.h"
+#include "upload.h"
+#include "depth.h"
+
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 800
 
 #define CHUNK_WIDTH_PX 50
 #define CHUNK_HEIGHT_PX 50
-#define CHUNK_SIZE_RESERVE_MULTIPLIER 4.0
+#define CHUNK_COUNT_ACROSS 16 // about this many chunks across the window
+#define CHUNK_LAYER_COUNT 1024 // texture array layers, first one is the placeholder
+#define TILE_CACHE_BUDGET_MB 256 // MANDELBROT_CACHE_MB overrides it
+#define ANCHOR_MAX_TILES 4294967296.0 // 2^32, offsets stay exact to well below a pixel
+#define ANCHOR_SNAP_BITS 16
+#define UPLOAD_CHUNKS_PER_FRAME 256 // staged texture uploads, more go straight to the texture
+#define PALETTE_SIZE 256
+#define PALETTE_PERIOD 32.0f // escape iterations per palette cycle
+#define PALETTE_CYCLE_SPEED 0.1 // palette cycles per second, while cycling
+#define WINDOW_TITLE "GLFW + OpenGL demo"
+#define GPU_TIMER_FRAMES 4 // timer query results are read this many frames later
+#define OVERLAY_PERIOD 0.25 // seconds between overlay updates
+#define OVERLAY_FRAMES 60 // frames the overlay averages over
+#define CHUNK_PASS_PRIORITY 1000.0 // per finer pass, above any distance in tiles
+#define CHUNK_PREFETCH_PRIORITY 1e6 // above any visible pass
+#define CHUNK_PREFETCH_RING 1 // tiles computed around the window
+#define CHUNK_PREFETCH_AHEAD 2 // more of them on the side the view moves to
+#define CHUNK_PREVIEW_LEVELS 4 // coarser levels searched for previews of a missing tile
+#define CHUNK_PREVIEW_MAX 4 // preview tiles under one tile: its four children
+#define ZOOM_STEP 0.32 // log2 of the zoom of a key press or a wheel notch (1.25x)
+#define ZOOM_SMOOTHING 0.08 // seconds, time constant of the zoom animation
 
 #define GL_ERROR_PRINT() \
 {                        \
@@ -22,10 +52,10 @@
 }
 #define BENCHMARK(expr) \
             { \
-                clock_t start = clock(); \
+                double start = glfwGetTime(); \
                 { expr } \
-                clock_t end = clock(); \
-                float ms = (float)(end - start) / CLOCKS_PER_SEC; \
+                double end = glfwGetTime(); \
+                double ms = end - start; \
                 printf("seconds: %lf\n", ms); \
             }
 
@@ -33,8 +63,6 @@
 GLuint create_shader(GLenum type, const char *code);
 GLuint create_shader_from_file(GLenum type, const char *filename);
 GLuint link_program(GLuint vertex_id, GLuint geometry_id, GLuint fragment_id);
-void compute_mandelbrot_chunk(const GLdouble pos[2], const GLdouble size[2], GLsizei width_px, GLsizei height_px, GLfloat *chunk);
-GLfloat compute_mandelbrot(long double x, long double y);
 
 
 static void glfw_error_callback(int e, const char *d) {
@@ -45,6 +73,322 @@ static void window_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
 }
 
+// Wheel notches since the render loop last looked, up is positive
+static double scroll_pending = 0.0;
+
+static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
+    (void)window;
+    (void)xoffset; // sideways scrolling does not zoom
+    scroll_pending += yoffset;
+}
+
+// Tile grids are laid out relative to an anchor point: the origin of the
+// plane, unless the view is too far from it for double offsets to resolve
+// its pixels. Then it is the view centre snapped to a grid of
+// 2^ANCHOR_SNAP_BITS tiles, so the same region (at the same level) always
+// gets the same anchor, in this session or the next one.
+struct view_anchor {
+    uint64_t digest;
+    struct bignum pos[2];
+};
+
+static void select_anchor(struct view_anchor *anchor, const struct bignum centre[2], int level) {
+    double side = tile_side(level);
+    if (fabs(bignum_to_double(&centre[0], BIGNUM_MAX_LIMBS)) < ANCHOR_MAX_TILES * side &&
+        fabs(bignum_to_double(&centre[1], BIGNUM_MAX_LIMBS)) < ANCHOR_MAX_TILES * side) {
+        bignum_from_double(&anchor->pos[0], 0.0);
+        bignum_from_double(&anchor->pos[1], 0.0);
+    } else {
+        int frac_bits = level - ANCHOR_SNAP_BITS - ilogb(TILE_ROOT_SIZE);
+        bignum_truncate(&anchor->pos[0], &centre[0], frac_bits);
+        bignum_truncate(&anchor->pos[1], &centre[1], frac_bits);
+    }
+    anchor->digest = bignum_hash(&anchor->pos[1], bignum_hash(&anchor->pos[0], 0xcbf29ce484222325ull));
+}
+
+// Store mode of a chunk: the precision it is computed in, or perturbation
+static int chunk_mode(const double pos[2], const double size[2], const struct reference_orbit *reference) {
+    if (reference) {
+        return TILE_MODE_PERTURBED;
+    }
+    return mandelbrot_select_precision(pos, size, CHUNK_WIDTH_PX, CHUNK_HEIGHT_PX);
+}
+
+// Distance from `offset` to the furthest pixel of the tiles [x0, x1] x [y0, y1]
+static double tiles_radius(const double offset[2], int64_t x0, int64_t x1, int64_t y0, int64_t y1, double side) {
+    return hypot(fmax(fabs(x0 * side - offset[0]), fabs((x1 + 1) * side - offset[0])),
+            fmax(fabs(y0 * side - offset[1]), fabs((y1 + 1) * side - offset[1])));
+}
+
+// Reference orbit at `offset` from the anchor, its series fitted up to `radius`,
+// iterated `depth` times
+static struct reference_orbit *create_reference(const struct view_anchor *anchor, const double offset[2], double radius, double side, int depth) {
+    struct bignum c[2];
+    bignum_add_double(&c[0], &anchor->pos[0], offset[0], BIGNUM_MAX_LIMBS);
+    bignum_add_double(&c[1], &anchor->pos[1], offset[1], BIGNUM_MAX_LIMBS);
+    struct reference_orbit *reference = reference_orbit_create(c, bignum_limbs_for_step(side / CHUNK_WIDTH_PX), depth);
+    reference_orbit_approximate(reference, radius, side / CHUNK_WIDTH_PX);
+    return reference;
+}
+
+// A tile to queue
+struct chunk_order {
+    int64_t tx;
+    int64_t ty;
+    struct tile *tile;  // cached coarse pass, or NULL
+};
+
+// What the pool works on: the visible tiles [x0, x1] x [y0, y1], and the
+// region around them that is computed ahead (prefetched)
+struct chunk_schedule {
+    int64_t x0, x1, y0, y1;
+    int64_t region_x0, region_x1, region_y0, region_y1;
+    double focus[2];    // in tiles
+};
+
+static int chunk_visible(const struct chunk_schedule *schedule, int64_t tx, int64_t ty) {
+    return tx >= schedule->x0 && tx <= schedule->x1 && ty >= schedule->y0 && ty <= schedule->y1;
+}
+
+// Queue priority of the pass `stride` of a tile, lower runs first: the
+// coarse passes of every visible tile, then their finer passes, then the
+// prefetched tiles, each by distance to the focus. Negative outside of the
+// region, the job is not needed any more
+static double chunk_priority(const struct chunk_schedule *schedule, int64_t tx, int64_t ty, int stride) {
+    if (tx < schedule->region_x0 || tx > schedule->region_x1 || ty < schedule->region_y0 || ty > schedule->region_y1) {
+        return -1.0;
+    }
+    double priority = hypot(tx + 0.5 - schedule->focus[0], ty + 0.5 - schedule->focus[1]);
+    priority += CHUNK_PASS_PRIORITY * log2((double)MANDELBROT_PASS_STRIDE / stride);
+    if (!chunk_visible(schedule, tx, ty)) {
+        priority += CHUNK_PREFETCH_PRIORITY;
+    }
+    return priority;
+}
+
+// A grid level other than the view's, to look for preview tiles in: while a
+// tile of the view is computed, cached tiles of another level that cover it
+// are drawn in its place, scaled to where they lie on the plane
+struct preview_level {
+    int level;
+    uint64_t anchor;    // digest
+    int depth;          // limit its tiles were likely computed with
+    double delta[2];    // view anchor minus its anchor
+};
+
+// Preview tiles of the view's tile (tx, ty): the four children one level
+// finer, when all of them are cached, or else the closest cached ancestor.
+// `levels` holds the finer level first, then the coarser ones, closest
+// first. Returns how many were found (0 when none), with their corners
+// relative to the view anchor, their side, and the pass stride they amount
+// to at the view's level: the view's own tile replaces them once it is at
+// least as fine
+static int chunk_preview_find(struct tile_cache *cache, const struct preview_level *levels, int level_count,
+        int level, int64_t tx, int64_t ty, struct tile *found[CHUNK_PREVIEW_MAX], double pos[CHUNK_PREVIEW_MAX][2],
+        double *side, int *stride) {
+    double view_side = tile_side(level);
+    for (int l = 0; l < level_count; l++) {
+        const struct preview_level *p = &levels[l];
+        double s = tile_side(p->level);
+        if (p->level > level) {
+            // Anchors are on the grid of the finer level, so the corner is a tile corner
+            int64_t x0 = (int64_t)floor((tx * view_side + p->delta[0]) / s + 0.5);
+            int64_t y0 = (int64_t)floor((ty * view_side + p->delta[1]) / s + 0.5);
+            int n = 0;
+            int finest = 1;
+            for (; n < 4; n++) {
+                struct tile_key key = { p->anchor, p->level, x0 + (n & 1), y0 + (n >> 1), p->depth };
+                found[n] = tile_cache_find(cache, &key);
+                if (!found[n]) {
+                    break;
+                }
+                pos[n][0] = key.x * s - p->delta[0];
+                pos[n][1] = key.y * s - p->delta[1];
+                finest = found[n]->stride > finest ? found[n]->stride : finest;
+            }
+            if (n == 4) {
+                *side = s;
+                *stride = finest > 1 ? finest / 2 : 1;
+                return 4;
+            }
+            continue;
+        }
+        struct tile_key key = {
+            p->anchor, p->level,
+            (int64_t)floor(((tx + 0.5) * view_side + p->delta[0]) / s),
+            (int64_t)floor(((ty + 0.5) * view_side + p->delta[1]) / s),
+            p->depth,
+        };
+        found[0] = tile_cache_find(cache, &key);
+        if (found[0]) {
+            pos[0][0] = key.x * s - p->delta[0];
+            pos[0][1] = key.y * s - p->delta[1];
+            *side = s;
+            *stride = found[0]->stride << (level - p->level);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+struct chunk_reschedule {
+    const struct chunk_schedule *schedule;
+    struct tile_cache *cache;
+};
+
+// For chunk_pool_reprioritize after a pan. A dropped refinement leaves its
+// tile coarse, to be queued again once it is back in the region
+static double chunk_reschedule(const struct chunk_job *job, void *ctx) {
+    struct chunk_reschedule *r = (struct chunk_reschedule*)ctx;
+    double priority = chunk_priority(r->schedule, job->key.x, job->key.y, job->stride);
+    if (priority < 0.0 && job->refine) {
+        struct tile *tile = tile_cache_find(r->cache, &job->key);
+        if (tile) {
+            tile->refining = 0;
+        }
+    }
+    return priority;
+}
+
+// Chunk values (see mandelbrot.h) as R16 texels, half the size of the floats
+static void chunk_encode(const float *pixels, uint16_t *texels) {
+    for (int i = 0; i < CHUNK_WIDTH_PX * CHUNK_HEIGHT_PX; i++) {
+        texels[i] = (uint16_t)(pixels[i] * 65535.0f + 0.5f);
+    }
+}
+
+// Texture layer of a cached tile, stages its pixels for upload if it was not resident
+static GLdouble tile_make_resident(struct tile_cache *cache, struct tile *tile, unsigned stamp, struct texture_stream *textures, struct frame_trace *trace) {
+    int needs_upload;
+    int layer = tile_cache_acquire_layer(cache, tile, stamp, &needs_upload);
+    if (needs_upload) {
+        int stage = frame_trace_stage(trace, FRAME_UPLOAD);
+        uint16_t *texels = (uint16_t*)texture_stream_slot(textures, layer);
+        if (texels) {
+            chunk_encode(tile->pixels, texels);
+        } else {
+            static uint16_t direct[CHUNK_WIDTH_PX * CHUNK_HEIGHT_PX];
+            chunk_encode(tile->pixels, direct);
+            texture_stream_upload(textures, layer, direct);
+        }
+        frame_trace_stage(trace, stage);
+    }
+    return (GLdouble)layer;
+}
+
+// Colour stops of a palette at positions in [0, 1]. The last one, at 1,
+// repeats the first, so the palette wraps around without a seam
+struct palette_stop {
+    float pos;
+    unsigned char rgb[3];
+};
+
+static const struct palette_stop palette_stops[][6] = {
+    { { 0.0f, { 0, 7, 100 } }, { 0.16f, { 32, 107, 203 } }, { 0.42f, { 237, 255, 255 } },
+      { 0.6425f, { 255, 170, 0 } }, { 0.8575f, { 0, 2, 0 } }, { 1.0f, { 0, 7, 100 } } },
+    { { 0.0f, { 0, 0, 0 } }, { 0.3f, { 180, 20, 0 } }, { 0.55f, { 255, 160, 0 } },
+      { 0.75f, { 255, 255, 200 } }, { 1.0f, { 0, 0, 0 } } },
+    { { 0.0f, { 0, 0, 0 } }, { 0.5f, { 255, 255, 255 } }, { 1.0f, { 0, 0, 0 } } },
+};
+#define PALETTE_COUNT (int)(sizeof(palette_stops) / sizeof(palette_stops[0]))
+
+// Palette `index` into the 1D palette texture
+static void palette_upload(GLuint texture, int index) {
+    const struct palette_stop *stops = palette_stops[index];
+    unsigned char rgba[PALETTE_SIZE * 4];
+    int s = 0;
+    for (int i = 0; i < PALETTE_SIZE; i++) {
+        float t = (float)i / PALETTE_SIZE;
+        while (stops[s + 1].pos < t) {
+            s++;
+        }
+        float f = (t - stops[s].pos) / (stops[s + 1].pos - stops[s].pos);
+        for (int k = 0; k < 3; k++) {
+            rgba[4 * i + k] = (unsigned char)(stops[s].rgb[k] + f * (stops[s + 1].rgb[k] - stops[s].rgb[k]) + 0.5f);
+        }
+        rgba[4 * i + 3] = 255;
+    }
+    glTextureSubImage1D(texture, 0, 0, PALETTE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+}
+
+// GL_TIME_ELAPSED queries around the GL work of the traced stages, one set
+// per frame in flight, so reading a result never waits for the GPU
+struct gpu_timers {
+    GLuint queries[GPU_TIMER_FRAMES][FRAME_STAGE_COUNT];
+    unsigned long frame[GPU_TIMER_FRAMES];
+    int issued[GPU_TIMER_FRAMES][FRAME_STAGE_COUNT];
+};
+
+// Hands the results of the frame that last used this frame's set to the
+// trace. Those not in yet are dropped, the queries are reused
+static void gpu_timers_collect(struct gpu_timers *timers, struct frame_trace *trace) {
+    if (!trace->enabled) {
+        return;
+    }
+    int slot = trace->frame % GPU_TIMER_FRAMES;
+    for (int s = 0; s < FRAME_STAGE_COUNT; s++) {
+        if (!timers->issued[slot][s]) {
+            continue;
+        }
+        timers->issued[slot][s] = 0;
+        GLint available = 0;
+        glGetQueryObjectiv(timers->queries[slot][s], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 ns;
+            glGetQueryObjectui64v(timers->queries[slot][s], GL_QUERY_RESULT, &ns);
+            frame_trace_gpu(trace, timers->frame[slot], s, (int64_t)ns);
+        }
+    }
+    timers->frame[slot] = trace->frame;
+}
+
+static void gpu_timer_begin(struct gpu_timers *timers, const struct frame_trace *trace, int stage) {
+    if (!trace->enabled) {
+        return;
+    }
+    int slot = trace->frame % GPU_TIMER_FRAMES;
+    glBeginQuery(GL_TIME_ELAPSED, timers->queries[slot][stage]);
+    timers->issued[slot][stage] = 1;
+}
+
+static void gpu_timer_end(const struct frame_trace *trace) {
+    if (trace->enabled) {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+}
+
+// Frame time, stage times, queued chunks, iteration limit, cache hit rate
+// and the time the last view took to complete (negative while it is not) in
+// the window title
+static void overlay_update(GLFWwindow *window, const struct frame_trace *trace, int depth, double view_ms) {
+    struct frame_summary summary;
+    if (!frame_trace_summary(trace, OVERLAY_FRAMES, &summary)) {
+        return;
+    }
+    char title[512];
+    int len = snprintf(title, sizeof(title), "%.1f ms (max %.1f) |", summary.frame_ms, summary.frame_max_ms);
+    for (int s = 0; s < FRAME_STAGE_COUNT && len < (int)sizeof(title); s++) {
+        len += snprintf(title + len, sizeof(title) - len, " %s %.2f", frame_stage_name(s), summary.cpu_ms[s]);
+        if (summary.gpu_ms[s] >= 0.0 && len < (int)sizeof(title)) {
+            len += snprintf(title + len, sizeof(title) - len, " (gpu %.2f)", summary.gpu_ms[s]);
+        }
+    }
+    if (len < (int)sizeof(title)) {
+        len += snprintf(title + len, sizeof(title) - len, " | %d queued | depth %d", summary.chunks_queued, depth);
+    }
+    if (summary.cache_hit_rate >= 0.0 && len < (int)sizeof(title)) {
+        len += snprintf(title + len, sizeof(title) - len, " | cache %.0f%% hits", 100.0 * summary.cache_hit_rate);
+    }
+    if (len < (int)sizeof(title)) {
+        if (view_ms >= 0.0) {
+            snprintf(title + len, sizeof(title) - len, " | view %.0f ms", view_ms);
+        } else {
+            snprintf(title + len, sizeof(title) - len, " | view pending");
+        }
+    }
+    glfwSetWindowTitle(window, title);
+}
+
 
 
 int main() {
@@ -59,7 +403,7 @@ int main() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     /* glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE); */
     GLFWwindow *window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT,
-                                    "GLFW + OpenGL demo", NULL, NULL);
+                                    WINDOW_TITLE, NULL, NULL);
     if (!window) {
         fprintf(stderr, "[GFLW] failed to init window!\n");
         glfwTerminate();
@@ -69,6 +413,7 @@ int main() {
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1); // enable vsync
     glfwSetWindowSizeCallback(window, window_size_callback);
+    glfwSetScrollCallback(window, scroll_callback);
     GLdouble window_rec[4] = { -1.8f, -1.0f, 2.4f, 2.0f };
     const GLFWvidmode *screen_resolution = glfwGetVideoMode(glfwGetPrimaryMonitor());
     // New New idea:
@@ -79,37 +424,43 @@ int main() {
     // displayed if the acrual texture is not yet calculated
     const GLsizei chunk_width = CHUNK_WIDTH_PX;
     const GLsizei chunk_height = CHUNK_HEIGHT_PX;
-    // TODO: calculate chunk count properly. If too many chunks, everything turns black
-    /* GLsizei chunk_count_x = (int)(screen_resolution->width / chunk_width) + 1 - 6; */
-    /* GLsizei chunk_count_y = (int)(screen_resolution->height / chunk_height) + 1 - 7; */
-    GLsizei chunk_count_x = 16;
-    GLsizei chunk_count_y = 16;
-    const GLsizei chunk_count = (int)(CHUNK_SIZE_RESERVE_MULTIPLIER * chunk_count_x * chunk_count_y);
+    // Chunks are tiles of a quadtree grid of the plane (see tilecache.h), all
+    // of one level at a time: about CHUNK_COUNT_ACROSS of them across the window
     GLdouble chunk_size[2] = {
-        window_rec[2] / chunk_count_x,
-        window_rec[3] / chunk_count_y,
+        window_rec[2] / CHUNK_COUNT_ACROSS,
+        window_rec[3] / CHUNK_COUNT_ACROSS,
     };
-    GLsizei chunk_pixel_data_len = chunk_width * chunk_height * chunk_count + 1;
-    GLfloat *chunk_pixel_data = (GLfloat*)malloc(chunk_pixel_data_len * sizeof(chunk_pixel_data[0]));
-    const GLsizei chunk_vertex_len = 3;
-    GLsizei chunk_vertex_data_len = chunk_vertex_len * chunk_count;
-    GLdouble *chunk_vertex_data = (GLdouble*)malloc(chunk_vertex_data_len * sizeof(chunk_vertex_data[0]));
+    GLfloat *chunk_pixel_data = (GLfloat*)malloc(chunk_width * chunk_height * sizeof(chunk_pixel_data[0]));
+    // Vertex: { x, y, texture layer, side }
+    const GLsizei chunk_vertex_len = 4;
+    // One vertex per visible chunk, grown when the window shows more of
+    // them, followed by the previews drawn under them
+    GLsizei chunk_vertex_count = 0;
+    GLsizei preview_vertex_count = 0;
+    GLsizei chunk_vertex_capacity = (CHUNK_PREVIEW_MAX + 1) * (CHUNK_COUNT_ACROSS + 2) * (CHUNK_COUNT_ACROSS + 2);
+    GLdouble *chunk_vertex_data = (GLdouble*)calloc(chunk_vertex_len * chunk_vertex_capacity, sizeof(chunk_vertex_data[0]));
+    // Visible tiles the current view still waits for, per vertex
+    unsigned char *chunk_pending = (unsigned char*)calloc(chunk_vertex_capacity, sizeof(chunk_pending[0]));
+    // Stride of the preview under each visible tile, 0 without one: the
+    // tile is shown once its pass is at least as fine
+    int *chunk_preview = (int*)calloc(chunk_vertex_capacity, sizeof(chunk_preview[0]));
     // TODO: gray texture is never displayed???
     // Init gray placeholder texture
     for (int i = 0; i < chunk_width * chunk_height; i++) {
         chunk_pixel_data[i] = 0.5f;
     }
-    // Init vertices
-    for (int i = 0; i < chunk_vertex_data_len; i++) {
-        chunk_pixel_data[i] = 0.0f;
-    }
 
+    // The texture array only holds the chunks the tile cache made resident
+    GLint max_layers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    const GLsizei chunk_layer_count = max_layers < CHUNK_LAYER_COUNT ? max_layers : CHUNK_LAYER_COUNT;
     GLuint chunk_array_texture;
     glActiveTexture(GL_TEXTURE0);
     glGenTextures(1, &chunk_array_texture);
     glBindTexture(GL_TEXTURE_2D_ARRAY, chunk_array_texture);
-    glTextureStorage3D(chunk_array_texture, 1, GL_R32F, chunk_width, chunk_height, chunk_count);
-    glTextureSubImage3D(chunk_array_texture, 0, 0, 0, 0, chunk_width, chunk_height, chunk_count, GL_RED, GL_FLOAT, chunk_pixel_data);
+    // Escape values as 16-bit normalized texels, coloured by the palette in chunk.frag
+    glTextureStorage3D(chunk_array_texture, 1, GL_R16, chunk_width, chunk_height, chunk_layer_count);
+    glTextureSubImage3D(chunk_array_texture, 0, 0, 0, 0, chunk_width, chunk_height, 1, GL_RED, GL_FLOAT, chunk_pixel_data);
 
     glTextureParameteri(chunk_array_texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTextureParameteri(chunk_array_texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -119,20 +470,44 @@ int main() {
     /* glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, { 1.0f, 0.0f, 0.0f, 1.0f }); */
     // TODO: use a texture mipmap instead
 
+    // Colours are looked up in a palette texture, changing or cycling it
+    // does not touch the chunks
+    int palette_index = 0;
+    GLuint palette_texture;
+    glActiveTexture(GL_TEXTURE1);
+    glGenTextures(1, &palette_texture);
+    glBindTexture(GL_TEXTURE_1D, palette_texture);
+    glTextureStorage1D(palette_texture, 1, GL_RGBA8, PALETTE_SIZE);
+    glTextureParameteri(palette_texture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(palette_texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(palette_texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    palette_upload(palette_texture, palette_index);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Finished chunks reach the texture through a persistently mapped
+    // staging buffer, in one batch per frame
+    struct texture_stream textures;
+    if (texture_stream_init(&textures, chunk_array_texture, chunk_width, chunk_height, GL_RED, GL_UNSIGNED_SHORT,
+                sizeof(uint16_t), UPLOAD_CHUNKS_PER_FRAME) != 0) {
+        fprintf(stderr, "Texture staging buffer can not be mapped, uploads are synchronous\n");
+    }
+
+    // The vertices as well, only the changed ones are written (see upload.h)
+    struct vertex_stream vertices;
+    if (vertex_stream_init(&vertices, chunk_vertex_len, chunk_vertex_capacity) != 0) {
+        fprintf(stderr, "[GL] failed to map the vertex buffer!\n");
+        glfwTerminate();
+        exit(1);
+    }
     GLuint vertex_array;
-    GLuint vertexbuffer;
     glGenVertexArrays(1, &vertex_array);
-    glGenBuffers(1, &vertexbuffer);
     glBindVertexArray(vertex_array);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-    glBufferData(GL_ARRAY_BUFFER, chunk_vertex_data_len * sizeof(chunk_vertex_data[0]), chunk_vertex_data, GL_DYNAMIC_DRAW);
     GLuint shader_data_ubo;
     glGenBuffers(1, &shader_data_ubo);
     glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
-    glBufferData(GL_UNIFORM_BUFFER, 4 * sizeof(window_rec[0]) + 2 * sizeof(chunk_size[0]), NULL, GL_DYNAMIC_DRAW);
+    glBufferData(GL_UNIFORM_BUFFER, 4 * sizeof(window_rec[0]), NULL, GL_DYNAMIC_DRAW);
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, shader_data_ubo);
     glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * sizeof(window_rec[0]), window_rec);
-    glBufferSubData(GL_UNIFORM_BUFFER, 4 * sizeof(window_rec[0]), 2 * sizeof(chunk_size[0]), chunk_size);
 
     // Chunk program config
     GLuint chunk_vertex_shader = create_shader_from_file(GL_VERTEX_SHADER, "shaders/chunk.vert");
@@ -140,16 +515,27 @@ int main() {
     GLuint chunk_fragment_shader = create_shader_from_file(GL_FRAGMENT_SHADER, "shaders/chunk.frag");
     GLuint chunk_program = link_program(chunk_vertex_shader, chunk_geometry_shader, chunk_fragment_shader);
     glUseProgram(chunk_program);
+    // Attributes read from binding point 0, so a grown vertex buffer only
+    // has to be bound there again
     GLuint position_attribute = glGetAttribLocation(chunk_program, "position");
     glEnableVertexAttribArray(position_attribute);
-    glVertexAttribLPointer(position_attribute, 3, GL_DOUBLE,
-            chunk_vertex_len * sizeof(chunk_vertex_data[0]), (void*)0);
+    glVertexArrayAttribLFormat(vertex_array, position_attribute, 2, GL_DOUBLE, 0);
+    glVertexArrayAttribBinding(vertex_array, position_attribute, 0);
     GLuint chunk_index_attribute = glGetAttribLocation(chunk_program, "chunk_index");
     glEnableVertexAttribArray(chunk_index_attribute);
-    glVertexAttribLPointer(chunk_index_attribute, 3, GL_DOUBLE,
-            chunk_vertex_len * sizeof(chunk_vertex_data[0]), (void*)(2 * sizeof(chunk_vertex_data[0])));
+    glVertexArrayAttribLFormat(vertex_array, chunk_index_attribute, 1, GL_DOUBLE, 2 * sizeof(chunk_vertex_data[0]));
+    glVertexArrayAttribBinding(vertex_array, chunk_index_attribute, 0);
+    GLuint chunk_side_attribute = glGetAttribLocation(chunk_program, "chunk_side");
+    glEnableVertexAttribArray(chunk_side_attribute);
+    glVertexArrayAttribLFormat(vertex_array, chunk_side_attribute, 1, GL_DOUBLE, 3 * sizeof(chunk_vertex_data[0]));
+    glVertexArrayAttribBinding(vertex_array, chunk_side_attribute, 0);
+    glVertexArrayVertexBuffer(vertex_array, 0, vertices.buffer, 0, chunk_vertex_len * sizeof(chunk_vertex_data[0]));
     GLuint chunk_array_attribute = glGetUniformLocation(chunk_program, "chunk_array");
     glUniform1i(chunk_array_attribute, 0);
+    glUniform1i(glGetUniformLocation(chunk_program, "palette"), 1);
+    glUniform1f(glGetUniformLocation(chunk_program, "palette_period"), PALETTE_PERIOD);
+    GLint palette_offset_uniform = glGetUniformLocation(chunk_program, "palette_offset");
+    glUniform1f(palette_offset_uniform, 0.0f);
     GLuint window_rec_index = glGetUniformBlockIndex(chunk_program, "window_rec");
     glUniformBlockBinding(chunk_program, window_rec_index, 0);
 
@@ -171,8 +557,12 @@ int main() {
         KEY_MOVE_LEFT,
         KEY_MOVE_RIGHT,
         KEY_VERTEX_RECALCULATE,
+        KEY_OVERLAY,
+        KEY_PALETTE,
+        KEY_PALETTE_CYCLE,
         MOUSE_BUTTON_LEFT,
         VERTEX_RECALCULATE,
+        VERTEX_PAN,
         KEY_ACTION_COUNT
     };
     int key_pressed[KEY_ACTION_COUNT] = { 0 };
@@ -180,10 +570,91 @@ int main() {
     int window_width, window_height;
     glfwGetFramebufferSize(window, &window_width, &window_height);
     int i = 0;
+    // Chunks are computed in the background, one worker per core
+    struct chunk_pool *pool = chunk_pool_create(0);
+    unsigned generation = chunk_pool_generation(pool);
+    fprintf(stderr, "Computing chunks on %d threads\n", chunk_pool_thread_count(pool));
+    // Computed chunks are kept across views, up to a memory budget
+    size_t cache_budget = (size_t)TILE_CACHE_BUDGET_MB << 20;
+    const char *cache_mb = getenv("MANDELBROT_CACHE_MB");
+    if (cache_mb) {
+        cache_budget = (size_t)(atof(cache_mb) * (1 << 20));
+    }
+    struct tile_cache *cache = tile_cache_create(cache_budget, chunk_layer_count, chunk_width * chunk_height);
+    // ... and on disk, across runs. MANDELBROT_TILE_STORE= (empty) disables it
+    char store_path[4096];
+    const char *store_env = getenv("MANDELBROT_TILE_STORE");
+    if (store_env) {
+        snprintf(store_path, sizeof(store_path), "%s", store_env);
+    } else {
+        const char *home = getenv("HOME");
+        snprintf(store_path, sizeof(store_path), "%s/.cache/mandelbrot-tiles.bin", home ? home : ".");
+    }
+    struct tile_store *store = NULL;
+    if (store_path[0]) {
+        store = tile_store_open(store_path, chunk_width, chunk_height);
+        if (store) {
+            fprintf(stderr, "Tile store %s: %d tiles\n", store_path, tile_store_count(store));
+        } else {
+            fprintf(stderr, "Tile store %s can not be opened, tiles are not kept\n", store_path);
+        }
+    }
+    // Plane coordinates on the GPU (window_rec, vertices) are relative to the
+    // current anchor, which is kept in bignum precision for deep zooms
+    struct view_anchor anchor;
+    struct bignum plane_origin[2];
+    bignum_from_double(&plane_origin[0], 0.0);
+    bignum_from_double(&plane_origin[1], 0.0);
+    select_anchor(&anchor, plane_origin, 0);
+    // Visible part of the grid: tiles of `level`, x in [tile_x0, tile_x1]
+    int level = 0;
+    int64_t tile_x0 = 0, tile_x1 = -1, tile_y0 = 0, tile_y1 = -1;
+    // Cache stamp of the visible set, bumped whenever it changes
+    unsigned view_stamp = 0;
+    struct reference_orbit *reference = NULL;
+    GLdouble reference_offset[2] = { 0.0, 0.0 }; // from the anchor
+    // Iteration limit of the view, from the zoom and the chunks computed so far
+    struct depth_control depth_control;
+    depth_control_init(&depth_control);
+    int depth = 0;
+    struct chunk_order *order = NULL;
+    int order_capacity = 0;
+    // Visible tiles first, then the ones the view moves towards
+    struct chunk_schedule schedule = { 0, -1, 0, -1, 0, -1, 0, -1, { 0.0, 0.0 } };
+    double schedule_centre[2] = { 0.0, 0.0 }; // in tiles, at the last schedule
+    // Latency to a complete view: from the navigation to the last visible
+    // tile at full resolution
+    double view_start = 0.0;
+    double view_ms = -1.0;
+    int view_pending = 0;
+    int deepen = 0; // the depth control restarts the view, not the user
+    // Frame stage timings: recorded while the overlay ('T') is shown, or for
+    // the whole session with MANDELBROT_TRACE=<file>, which gets the trace
+    struct frame_trace trace;
+    frame_trace_init(&trace);
+    const char *trace_path = getenv("MANDELBROT_TRACE");
+    if (trace_path && !trace_path[0]) {
+        trace_path = NULL;
+    }
+    frame_trace_enable(&trace, trace_path != NULL);
+    struct gpu_timers gpu_timers = { 0 };
+    glGenQueries(GPU_TIMER_FRAMES * FRAME_STAGE_COUNT, &gpu_timers.queries[0][0]);
+    int overlay = 0;
+    double overlay_time = 0.0;
+    int palette_cycle = 0;
+    double palette_offset = 0.0;
+    double palette_time = 0.0;
+    GLint vertex_first = 0;
+    // Zoom still to animate, as log2 of the window size, and the point of
+    // the window (as fractions of its size) it keeps in place
+    double zoom_remaining = 0.0;
+    double zoom_focus[2] = { 0.5, 0.5 };
+    double zoom_time = glfwGetTime();
     // Calculate chunks at the start of the program
     key_pressed[VERTEX_RECALCULATE] = 1;
-    // TODO: scroll input event
     while (!glfwWindowShouldClose(window)) {
+        frame_trace_begin(&trace);
+        gpu_timers_collect(&gpu_timers, &trace);
         // Events handling
         glfwPollEvents();
         /* glfwWaitEvents(); */
@@ -194,6 +665,9 @@ int main() {
             window_rec[3] *= (double)curr_window_height / window_height;
             window_width = curr_window_width;
             window_height = curr_window_height;
+            glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * sizeof(window_rec[0]), window_rec);
+            key_pressed[VERTEX_PAN] = 1;
         }
         if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS ||
             glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
@@ -203,19 +677,9 @@ int main() {
             glfwGetKey(window, GLFW_KEY_KP_ADD) == GLFW_PRESS) {
             if (!key_pressed[KEY_ZOOM_IN]) {
                 key_pressed[KEY_ZOOM_IN] = 1;
-                key_pressed[VERTEX_RECALCULATE] = 1;
-                #define ZOOM_IN 0.2 // (1 out of 5)
-                double dx = ZOOM_IN * window_rec[2];
-                double dy = ZOOM_IN * window_rec[3];
-                window_rec[0] += 0.5 * dx;
-                window_rec[1] += 0.5 * dy;
-                window_rec[2] -= dx;
-                window_rec[3] -= dy;
-                chunk_size[0] -= ZOOM_IN * chunk_size[0];
-                chunk_size[1] -= ZOOM_IN * chunk_size[1];
-                glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
-                glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * sizeof(window_rec[0]), window_rec);
-                glBufferSubData(GL_UNIFORM_BUFFER, 4 * sizeof(window_rec[0]), 2 * sizeof(chunk_size[0]), chunk_size);
+                zoom_remaining -= ZOOM_STEP;
+                zoom_focus[0] = 0.5;
+                zoom_focus[1] = 0.5;
             }
         } else {
             key_pressed[KEY_ZOOM_IN] = 0;
@@ -224,23 +688,43 @@ int main() {
             glfwGetKey(window, GLFW_KEY_KP_SUBTRACT) == GLFW_PRESS) {
             if (!key_pressed[KEY_ZOOM_OUT]) {
                 key_pressed[KEY_ZOOM_OUT] = 1;
-                key_pressed[VERTEX_RECALCULATE] = 1;
-                #define ZOOM_OUT 0.25 // (1 out of 4)
-                double dx = ZOOM_OUT * window_rec[2];
-                double dy = ZOOM_OUT * window_rec[3];
-                window_rec[0] -= 0.5 * dx;
-                window_rec[1] -= 0.5 * dy;
-                window_rec[2] += dx;
-                window_rec[3] += dy;
-                chunk_size[0] += ZOOM_OUT * chunk_size[0];
-                chunk_size[1] += ZOOM_OUT * chunk_size[1];
-                glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
-                glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * sizeof(window_rec[0]), window_rec);
-                glBufferSubData(GL_UNIFORM_BUFFER, 4 * sizeof(window_rec[0]), 2 * sizeof(chunk_size[0]), chunk_size);
+                zoom_remaining += ZOOM_STEP;
+                zoom_focus[0] = 0.5;
+                zoom_focus[1] = 0.5;
             }
         } else {
             key_pressed[KEY_ZOOM_OUT] = 0;
         }
+        // The wheel zooms around the cursor
+        if (scroll_pending != 0.0) {
+            double posx, posy;
+            glfwGetCursorPos(window, &posx, &posy);
+            zoom_remaining -= ZOOM_STEP * scroll_pending;
+            zoom_focus[0] = fmin(fmax(posx / window_width, 0.0), 1.0);
+            zoom_focus[1] = fmin(fmax(1.0 - posy / window_height, 0.0), 1.0);
+            scroll_pending = 0.0;
+        }
+        // Zooms are animated: each frame covers part of what is left, and
+        // the view only changes grid level (and starts over) once it has
+        // zoomed far enough. Until then it is a pan of the same tiles
+        double zoom_now = glfwGetTime();
+        if (zoom_remaining != 0.0) {
+            double step = zoom_remaining * (1.0 - exp(-(zoom_now - zoom_time) / ZOOM_SMOOTHING));
+            if (fabs(zoom_remaining - step) < 0.01 * ZOOM_STEP) {
+                step = zoom_remaining;
+            }
+            zoom_remaining -= step;
+            double scale = exp2(step);
+            for (int k = 0; k < 2; k++) {
+                double fixed = window_rec[k] + zoom_focus[k] * window_rec[2 + k];
+                window_rec[2 + k] *= scale;
+                window_rec[k] = fixed - zoom_focus[k] * window_rec[2 + k];
+            }
+            glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * sizeof(window_rec[0]), window_rec);
+            key_pressed[VERTEX_PAN] = 1;
+        }
+        zoom_time = zoom_now;
         if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
             if (!key_pressed[KEY_VERTEX_RECALCULATE]) {
                 key_pressed[KEY_VERTEX_RECALCULATE] = 1;
@@ -249,6 +733,46 @@ int main() {
         } else {
             key_pressed[KEY_VERTEX_RECALCULATE] = 0;
         }
+        if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
+            if (!key_pressed[KEY_OVERLAY]) {
+                key_pressed[KEY_OVERLAY] = 1;
+                overlay = !overlay;
+                frame_trace_enable(&trace, overlay || trace_path);
+                if (!overlay) {
+                    glfwSetWindowTitle(window, WINDOW_TITLE);
+                }
+            }
+        } else {
+            key_pressed[KEY_OVERLAY] = 0;
+        }
+        if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+            if (!key_pressed[KEY_PALETTE]) {
+                key_pressed[KEY_PALETTE] = 1;
+                palette_index = (palette_index + 1) % PALETTE_COUNT;
+                palette_upload(palette_texture, palette_index);
+            }
+        } else {
+            key_pressed[KEY_PALETTE] = 0;
+        }
+        if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
+            if (!key_pressed[KEY_PALETTE_CYCLE]) {
+                key_pressed[KEY_PALETTE_CYCLE] = 1;
+                palette_cycle = !palette_cycle;
+                palette_time = glfwGetTime();
+            }
+        } else {
+            key_pressed[KEY_PALETTE_CYCLE] = 0;
+        }
+        if (palette_cycle) {
+            double now = glfwGetTime();
+            palette_offset = fmod(palette_offset + (now - palette_time) * PALETTE_CYCLE_SPEED, 1.0);
+            palette_time = now;
+            glUniform1f(palette_offset_uniform, (GLfloat)palette_offset);
+        }
+        if (overlay && glfwGetTime() - overlay_time >= OVERLAY_PERIOD) {
+            overlay_time = glfwGetTime();
+            overlay_update(window, &trace, depth, view_ms);
+        }
         #define MOVE_COEF 0.1f
         if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
             if (!key_pressed[KEY_MOVE_UP]) {
@@ -256,6 +780,7 @@ int main() {
                 window_rec[1] += MOVE_COEF * window_rec[3];
                 glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
                 glBufferSubData(GL_UNIFORM_BUFFER, 0, 2 * sizeof(window_rec[0]), window_rec);
+                key_pressed[VERTEX_PAN] = 1;
             }
         } else {
             key_pressed[KEY_MOVE_UP] = 0;
@@ -266,6 +791,7 @@ int main() {
                 window_rec[1] -= MOVE_COEF * window_rec[3];
                 glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
                 glBufferSubData(GL_UNIFORM_BUFFER, 0, 2 * sizeof(window_rec[0]), window_rec);
+                key_pressed[VERTEX_PAN] = 1;
             }
         } else {
             key_pressed[KEY_MOVE_DOWN] = 0;
@@ -276,6 +802,7 @@ int main() {
                 window_rec[0] -= MOVE_COEF * window_rec[2];
                 glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
                 glBufferSubData(GL_UNIFORM_BUFFER, 0, 2 * sizeof(window_rec[0]), window_rec);
+                key_pressed[VERTEX_PAN] = 1;
             }
         } else {
             key_pressed[KEY_MOVE_LEFT] = 0;
@@ -286,6 +813,7 @@ int main() {
                 window_rec[0] += MOVE_COEF * window_rec[2];
                 glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
                 glBufferSubData(GL_UNIFORM_BUFFER, 0, 2 * sizeof(window_rec[0]), window_rec);
+                key_pressed[VERTEX_PAN] = 1;
             }
         } else {
             key_pressed[KEY_MOVE_RIGHT] = 0;
@@ -302,79 +830,429 @@ int main() {
                 window_rec[1] += dy / window_height * window_rec[3];
                 glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
                 glBufferSubData(GL_UNIFORM_BUFFER, 0, 2 * sizeof(window_rec[0]), window_rec);
+                key_pressed[VERTEX_PAN] = 1;
             }
             mouse_posx = posx;
             mouse_posy = posy;
         } else {
             key_pressed[MOUSE_BUTTON_LEFT] = 0;
         }
-        if (key_pressed[VERTEX_RECALCULATE]) {
+        if (key_pressed[VERTEX_RECALCULATE] || key_pressed[VERTEX_PAN]) {
+            frame_trace_stage(&trace, FRAME_VERTICES);
+            gpu_timer_begin(&gpu_timers, &trace, FRAME_VERTICES);
+            int recalculate = key_pressed[VERTEX_RECALCULATE];
             key_pressed[VERTEX_RECALCULATE] = 0;
-            // Calculate new vertex positions
-            int counter = 1;
-            for (int i = 0; i < chunk_count_y + 1; i++) {
-                for (int j = 0; j < chunk_count_x + 1; j++) {
-                    int vertex_data_offset = (counter - 1) * chunk_vertex_len;
-                    chunk_vertex_data[vertex_data_offset + 0] = window_rec[0] + j * chunk_size[0];
-                    chunk_vertex_data[vertex_data_offset + 1] = window_rec[1] + i * chunk_size[1];
-                    chunk_vertex_data[vertex_data_offset + 2] = 0.0f;
-                    counter++;
+            key_pressed[VERTEX_PAN] = 0;
+            // Grid level with about CHUNK_COUNT_ACROSS tiles across the window
+            GLdouble window_extent = fmax(window_rec[2], window_rec[3]);
+            int view_level = (int)floor(log2(CHUNK_COUNT_ACROSS * TILE_ROOT_SIZE / window_extent) + 0.5);
+            if (view_level != level) {
+                recalculate = 1;
+            }
+            if (recalculate) {
+                // Drop whatever is still queued for the previous view
+                generation = chunk_pool_cancel(pool);
+                level = view_level;
+                chunk_size[0] = tile_side(level);
+                chunk_size[1] = tile_side(level);
+                // Per grid level, not per zoom step, so the tiles of a level share it
+                depth = depth_control_view(&depth_control, CHUNK_COUNT_ACROSS * tile_side(level));
+                // Window centre in full precision, and the anchor it is drawn relative to
+                struct bignum centre[2];
+                for (int k = 0; k < 2; k++) {
+                    bignum_add_double(&centre[k], &anchor.pos[k], window_rec[k] + 0.5 * window_rec[2 + k], BIGNUM_MAX_LIMBS);
+                }
+                struct view_anchor new_anchor;
+                select_anchor(&new_anchor, centre, level);
+                if (new_anchor.digest != anchor.digest) {
+                    anchor = new_anchor;
+                    for (int k = 0; k < 2; k++) {
+                        struct bignum d;
+                        bignum_sub(&d, &centre[k], &anchor.pos[k], BIGNUM_MAX_LIMBS);
+                        window_rec[k] = bignum_to_double(&d, BIGNUM_MAX_LIMBS) - 0.5 * window_rec[2 + k];
+                    }
+                }
+                glBindBuffer(GL_UNIFORM_BUFFER, shader_data_ubo);
+                glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * sizeof(window_rec[0]), window_rec);
+                if (reference) {
+                    reference_orbit_release(reference);
+                    reference = NULL;
                 }
             }
-            glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-            glBufferData(GL_ARRAY_BUFFER, chunk_vertex_data_len * sizeof(chunk_vertex_data[0]), chunk_vertex_data, GL_DYNAMIC_DRAW);
-        } else {
-            #define DELAY_MAX 0.010f // 10ms
-            clock_t start = clock();
-            // Calculate one or more chunks, if given enougth time per frame
-            while ((float)(clock() - start) / CLOCKS_PER_SEC < DELAY_MAX) {
-                // Find vertex with an uninitialized chunk texture
-                int counter = 1;
-                int limit = (chunk_count_y + 1) * (chunk_count_x + 1) + 1;
-                int vertex_data_offset = 0;
-                for (; counter < limit; counter++) {
-                    vertex_data_offset = (counter - 1) * chunk_vertex_len;
-                    if (chunk_vertex_data[vertex_data_offset + 2] == 0.0f) {
-                        chunk_vertex_data[vertex_data_offset + 2] = (GLdouble)counter;
-                        break;
+            GLdouble side = chunk_size[0];
+            // Tiles touching the window. A pan that keeps them needs no work
+            int64_t x0 = (int64_t)floor(window_rec[0] / side);
+            int64_t x1 = (int64_t)floor((window_rec[0] + window_rec[2]) / side);
+            int64_t y0 = (int64_t)floor(window_rec[1] / side);
+            int64_t y1 = (int64_t)floor((window_rec[1] + window_rec[3]) / side);
+            if (recalculate || x0 != tile_x0 || x1 != tile_x1 || y0 != tile_y0 || y1 != tile_y1) {
+                // After a pan, tiles of the old region that are not cached yet
+                // are still queued for this generation
+                int panned = !recalculate;
+                int64_t queued_x0 = schedule.region_x0, queued_x1 = schedule.region_x1;
+                int64_t queued_y0 = schedule.region_y0, queued_y1 = schedule.region_y1;
+                if (recalculate) {
+                    queued_x1 = queued_x0 - 1;
+                }
+                tile_x0 = x0;
+                tile_x1 = x1;
+                tile_y0 = y0;
+                tile_y1 = y1;
+                view_stamp++;
+                GLdouble anchor_pos[2] = {
+                    bignum_to_double(&anchor.pos[0], BIGNUM_MAX_LIMBS),
+                    bignum_to_double(&anchor.pos[1], BIGNUM_MAX_LIMBS),
+                };
+                GLdouble centre_offset[2] = {
+                    window_rec[0] + 0.5 * window_rec[2],
+                    window_rec[1] + 0.5 * window_rec[3],
+                };
+                int tiles_x = (int)(x1 - x0 + 1);
+                chunk_vertex_count = tiles_x * (int)(y1 - y0 + 1);
+                if ((CHUNK_PREVIEW_MAX + 1) * chunk_vertex_count > chunk_vertex_capacity) {
+                    chunk_vertex_capacity = (CHUNK_PREVIEW_MAX + 1) * chunk_vertex_count;
+                    chunk_vertex_data = (GLdouble*)realloc(chunk_vertex_data, chunk_vertex_len * chunk_vertex_capacity * sizeof(chunk_vertex_data[0]));
+                    chunk_pending = (unsigned char*)realloc(chunk_pending, chunk_vertex_capacity * sizeof(chunk_pending[0]));
+                    chunk_preview = (int*)realloc(chunk_preview, chunk_vertex_capacity * sizeof(chunk_preview[0]));
+                    int reserved = vertex_stream_reserve(&vertices, chunk_vertex_capacity);
+                    if (reserved < 0) {
+                        fprintf(stderr, "[GL] failed to map the vertex buffer!\n");
+                        glfwTerminate();
+                        exit(1);
+                    }
+                    if (reserved) {
+                        glVertexArrayVertexBuffer(vertex_array, 0, vertices.buffer, 0, chunk_vertex_len * sizeof(chunk_vertex_data[0]));
                     }
                 }
-                // According to the banchmark, this block can take up to 16ms
-                if (counter != limit) {
-                    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-                    glBufferData(GL_ARRAY_BUFFER, chunk_vertex_data_len * sizeof(chunk_vertex_data[0]), chunk_vertex_data, GL_DYNAMIC_DRAW);
-                    // TODO: i'm unable to use a more efficient call
-                    /* glBufferSubData(GL_ARRAY_BUFFER, vertex_data_offset + 2, */
-                    /*         sizeof(chunk_vertex_data[0]), &chunk_vertex_data[vertex_data_offset + 2]); */
-                    /* glBufferSubData(GL_ARRAY_BUFFER, vertex_data_offset, */
-                    /*         chunk_vertex_len * sizeof(chunk_vertex_data[0]), &chunk_vertex_data[vertex_data_offset]); */
-                    // Calculate the chunk
-                    int chunk_pixel_offset = counter * chunk_width * chunk_height;
-                    compute_mandelbrot_chunk(&chunk_vertex_data[vertex_data_offset], chunk_size, chunk_width, chunk_height, &chunk_pixel_data[chunk_pixel_offset]);
-                    glTextureSubImage3D(chunk_array_texture, 0, 0, 0, counter, chunk_width, chunk_height, 1, GL_RED, GL_FLOAT, &chunk_pixel_data[chunk_pixel_offset]);
-                } else {
+                // Refinement starts next to the cursor, or the window centre
+                GLdouble focus[2] = { centre_offset[0], centre_offset[1] };
+                double cursor_x, cursor_y;
+                glfwGetCursorPos(window, &cursor_x, &cursor_y);
+                if (cursor_x >= 0 && cursor_x < window_width && cursor_y >= 0 && cursor_y < window_height) {
+                    focus[0] = window_rec[0] + cursor_x / window_width * window_rec[2];
+                    focus[1] = window_rec[1] + (1.0 - cursor_y / window_height) * window_rec[3];
+                }
+                // The pool computes the window, a ring of tiles around it and,
+                // while panning, a few more on the side the view moves to
+                double centre_tiles[2] = { centre_offset[0] / side, centre_offset[1] / side };
+                double motion[2] = { 0.0, 0.0 };
+                for (int k = 0; k < 2; k++) {
+                    if (panned) {
+                        motion[k] = centre_tiles[k] - schedule_centre[k];
+                    }
+                    schedule_centre[k] = centre_tiles[k];
+                    schedule.focus[k] = focus[k] / side;
+                }
+                schedule.x0 = x0;
+                schedule.x1 = x1;
+                schedule.y0 = y0;
+                schedule.y1 = y1;
+                schedule.region_x0 = x0 - CHUNK_PREFETCH_RING - (motion[0] < 0.0 ? CHUNK_PREFETCH_AHEAD : 0);
+                schedule.region_x1 = x1 + CHUNK_PREFETCH_RING + (motion[0] > 0.0 ? CHUNK_PREFETCH_AHEAD : 0);
+                schedule.region_y0 = y0 - CHUNK_PREFETCH_RING - (motion[1] < 0.0 ? CHUNK_PREFETCH_AHEAD : 0);
+                schedule.region_y1 = y1 + CHUNK_PREFETCH_RING + (motion[1] > 0.0 ? CHUNK_PREFETCH_AHEAD : 0);
+                if (panned) {
+                    // What is queued follows the new focus, what fell out of
+                    // the region is dropped
+                    struct chunk_reschedule reschedule = { &schedule, cache };
+                    chunk_pool_reprioritize(pool, chunk_reschedule, &reschedule);
+                }
+                // Past what direct iteration resolves, every chunk is perturbed
+                // around one reference orbit at the window centre. A pan keeps
+                // it, unless the new region is outside of its series.
+                GLdouble centre_pos[2] = { anchor_pos[0] + centre_offset[0], anchor_pos[1] + centre_offset[1] };
+                if (reference && reference->series_skip > 0 &&
+                    tiles_radius(reference_offset, schedule.region_x0, schedule.region_x1, schedule.region_y0, schedule.region_y1, side) > reference->series_radius) {
+                    reference_orbit_release(reference);
+                    reference = NULL;
+                    recalculate = 1;
+                }
+                if (recalculate && perturbation_needed(centre_pos, chunk_size, chunk_width, chunk_height)) {
+                    reference_offset[0] = centre_offset[0];
+                    reference_offset[1] = centre_offset[1];
+                    double radius = tiles_radius(reference_offset, schedule.region_x0, schedule.region_x1, schedule.region_y0, schedule.region_y1, side);
+                    reference = create_reference(&anchor, reference_offset, radius, side, depth);
+                }
+                if (!deepen) {
+                    view_start = glfwGetTime();
+                }
+                deepen = 0;
+                view_pending = 0;
+                int order_count = 0;
+                int region_count = (int)((schedule.region_x1 - schedule.region_x0 + 1) * (schedule.region_y1 - schedule.region_y0 + 1));
+                if (region_count > order_capacity) {
+                    order_capacity = region_count;
+                    order = (struct chunk_order*)realloc(order, order_capacity * sizeof(order[0]));
+                }
+                // Show the cached tiles right away, and note what is missing
+                // or still coarse. Nothing is inserted in this loop, so no
+                // tile the view needs can be evicted.
+                for (int64_t ty = schedule.region_y0; ty <= schedule.region_y1; ty++) {
+                    for (int64_t tx = schedule.region_x0; tx <= schedule.region_x1; tx++) {
+                        int visible = chunk_visible(&schedule, tx, ty);
+                        int vertex = (int)((ty - y0) * tiles_x + (tx - x0));
+                        int vertex_data_offset = vertex * chunk_vertex_len;
+                        if (visible) {
+                            chunk_vertex_data[vertex_data_offset + 0] = tx * side;
+                            chunk_vertex_data[vertex_data_offset + 1] = ty * side;
+                            chunk_vertex_data[vertex_data_offset + 2] = 0.0;
+                            chunk_vertex_data[vertex_data_offset + 3] = side;
+                            chunk_preview[vertex] = 0;
+                        }
+                        struct tile_key key = { anchor.digest, level, tx, ty, depth };
+                        struct tile *tile = tile_cache_lookup(cache, &key);
+                        if (visible) {
+                            chunk_pending[vertex] = !tile || tile->stride != 1;
+                            view_pending += chunk_pending[vertex];
+                        }
+                        if (tile) {
+                            tile_cache_touch(cache, tile, view_stamp);
+                            if (visible) {
+                                chunk_vertex_data[vertex_data_offset + 2] = tile_make_resident(cache, tile, view_stamp, &textures, &trace);
+                            }
+                            // Coarse, and its next pass is not queued
+                            if (tile->stride == 1 || tile->refining == generation) {
+                                continue;
+                            }
+                        } else if (tx >= queued_x0 && tx <= queued_x1 && ty >= queued_y0 && ty <= queued_y1) {
+                            // Only the newly exposed strip is missing after a pan
+                            continue;
+                        }
+                        order[order_count].tx = tx;
+                        order[order_count].ty = ty;
+                        order[order_count].tile = tile;
+                        order_count++;
+                    }
+                }
+                for (int n = 0; n < order_count; n++) {
+                    int64_t tx = order[n].tx;
+                    int64_t ty = order[n].ty;
+                    struct tile_key key = { anchor.digest, level, tx, ty, depth };
+                    // Chunks are computed from their top-left corner downwards
+                    GLdouble chunk_pos[2] = { tx * side, (ty + 1) * side };
+                    for (int k = 0; k < 2; k++) {
+                        chunk_pos[k] += reference ? -reference_offset[k] : anchor_pos[k];
+                    }
+                    struct tile *tile = order[n].tile;
+                    if (!tile) {
+                        // Computed in an earlier run
+                        const float *stored = store ? tile_store_lookup(store, &key, chunk_mode(chunk_pos, chunk_size, reference)) : NULL;
+                        if (stored) {
+                            tile = tile_cache_insert(cache, &key, stored, 1, view_stamp);
+                            if (chunk_visible(&schedule, tx, ty)) {
+                                int vertex = (int)((ty - y0) * tiles_x + (tx - x0));
+                                chunk_vertex_data[vertex * chunk_vertex_len + 2] = tile_make_resident(cache, tile, view_stamp, &textures, &trace);
+                                chunk_pending[vertex] = 0;
+                                view_pending--;
+                            }
+                            continue;
+                        }
+                    }
+                    struct chunk_job *job = chunk_job_create(chunk_pos, chunk_size, chunk_width, chunk_height, &key, generation, reference);
+                    job->depth = depth;
+                    job->stride = MANDELBROT_PASS_STRIDE;
+                    if (tile) {
+                        // Carry on from the cached pass
+                        memcpy(job->pixels, tile->pixels, chunk_width * chunk_height * sizeof(job->pixels[0]));
+                        job->stride = tile->stride / 2;
+                        job->refine = 1;
+                        tile->refining = generation;
+                    }
+                    job->priority = chunk_priority(&schedule, tx, ty, job->stride);
+                    chunk_pool_submit(pool, job);
+                }
+                // What is missing or coarse is drawn over cached tiles of the
+                // levels around, so a zoom does not blank the window. Their
+                // layers come out of what the region leaves over
+                preview_vertex_count = 0;
+                int preview_budget = chunk_layer_count - 1 - region_count;
+                struct preview_level levels[CHUNK_PREVIEW_LEVELS + 1];
+                int level_count = 0;
+                if (view_pending > 0) {
+                    struct bignum centre[2];
+                    for (int k = 0; k < 2; k++) {
+                        bignum_add_double(&centre[k], &anchor.pos[k], centre_offset[k], BIGNUM_MAX_LIMBS);
+                    }
+                    // The finer level first, then the coarser ones
+                    for (int d = -1; d <= CHUNK_PREVIEW_LEVELS; d++) {
+                        if (d == 0 || level - d < 0) {
+                            continue;
+                        }
+                        struct preview_level *p = &levels[level_count++];
+                        struct view_anchor level_anchor;
+                        p->level = level - d;
+                        select_anchor(&level_anchor, centre, p->level);
+                        p->anchor = level_anchor.digest;
+                        p->depth = depth_control_at(&depth_control, CHUNK_COUNT_ACROSS * tile_side(p->level));
+                        for (int k = 0; k < 2; k++) {
+                            struct bignum delta;
+                            bignum_sub(&delta, &anchor.pos[k], &level_anchor.pos[k], BIGNUM_MAX_LIMBS);
+                            p->delta[k] = bignum_to_double(&delta, BIGNUM_MAX_LIMBS);
+                        }
+                    }
+                }
+                for (int vertex = 0; vertex < chunk_vertex_count && level_count > 0; vertex++) {
+                    if (!chunk_pending[vertex]) {
+                        continue;
+                    }
+                    int64_t tx = x0 + vertex % tiles_x;
+                    int64_t ty = y0 + vertex / tiles_x;
+                    struct tile *found[CHUNK_PREVIEW_MAX];
+                    double found_pos[CHUNK_PREVIEW_MAX][2];
+                    double found_side;
+                    int found_stride;
+                    int n = chunk_preview_find(cache, levels, level_count, level, tx, ty, found, found_pos, &found_side, &found_stride);
+                    int shown = n > 0;
+                    for (int f = 0; f < n && shown; f++) {
+                        // Tiles under several of the view's are drawn once
+                        if (found[f]->stamp != view_stamp) {
+                            if (preview_vertex_count >= preview_budget) {
+                                shown = 0;
+                                break;
+                            }
+                            tile_cache_touch(cache, found[f], view_stamp);
+                            GLdouble *v = chunk_vertex_data + (size_t)(chunk_vertex_count + preview_vertex_count++) * chunk_vertex_len;
+                            v[0] = found_pos[f][0];
+                            v[1] = found_pos[f][1];
+                            v[2] = tile_make_resident(cache, found[f], view_stamp, &textures, &trace);
+                            v[3] = found_side;
+                        }
+                        shown = found[f]->layer != 0;
+                    }
+                    if (!shown) {
+                        continue;
+                    }
+                    chunk_preview[vertex] = found_stride;
+                    // A coarser pass of the tile itself stays hidden
+                    struct tile_key key = { anchor.digest, level, tx, ty, depth };
+                    struct tile *tile = tile_cache_find(cache, &key);
+                    if (tile && tile->stride > found_stride) {
+                        chunk_vertex_data[vertex * chunk_vertex_len + 2] = 0.0;
+                    }
+                }
+                view_ms = view_pending ? -1.0 : (glfwGetTime() - view_start) * 1000.0;
+                vertex_stream_changed_all(&vertices);
+            }
+            gpu_timer_end(&trace);
+        }
+        {
+            frame_trace_stage(&trace, FRAME_CHUNKS);
+            // All GL work of the drain is uploads
+            gpu_timer_begin(&gpu_timers, &trace, FRAME_UPLOAD);
+            // Wall time: the pool threads make clock() run faster than it
+            #define DELAY_MAX 0.010 // 10ms
+            double start = glfwGetTime();
+            int chunks_done = 0;
+            // Upload the chunks computed by the pool, if given enougth time per frame
+            while (glfwGetTime() - start < DELAY_MAX) {
+                struct chunk_job *job = chunk_pool_poll(pool);
+                if (!job) {
                     break;
                 }
+                chunks_done++;
+                // Tiles don't depend on the view, so results of an abandoned
+                // view still go to the cache (and the store, once complete)
+                struct tile *tile = tile_cache_insert(cache, &job->key, job->pixels, job->stride, view_stamp);
+                if (job->stride == 1 && store && tile_store_append(store, &job->key, chunk_mode(job->pos, job->size, job->reference), job->pixels) != 0) {
+                    fprintf(stderr, "Tile store: write failed, tiles are not kept any more\n");
+                    tile_store_close(store);
+                    store = NULL;
+                }
+                const struct tile_key *key = &job->key;
+                if (key->anchor == anchor.digest && key->level == level && key->depth == depth &&
+                    key->x >= tile_x0 && key->x <= tile_x1 && key->y >= tile_y0 && key->y <= tile_y1) {
+                    int vertex = (int)((key->y - tile_y0) * (tile_x1 - tile_x0 + 1) + (key->x - tile_x0));
+                    // Until it is as fine as its preview, the preview stays
+                    if (!chunk_preview[vertex] || tile->stride <= chunk_preview[vertex]) {
+                        chunk_vertex_data[vertex * chunk_vertex_len + 2] = tile_make_resident(cache, tile, view_stamp, &textures, &trace);
+                        vertex_stream_changed(&vertices, vertex);
+                    }
+                    if (job->stride == 1 && chunk_pending[vertex]) {
+                        chunk_pending[vertex] = 0;
+                        if (--view_pending == 0) {
+                            view_ms = (glfwGetTime() - view_start) * 1000.0;
+                        }
+                    }
+                    // Detail cut off by the limit: the view starts over, deeper
+                    if (job->stride == 1 && job->generation == generation && depth_control.depth == depth &&
+                        depth_control_observe(&depth_control, job->pixels, chunk_width * chunk_height)) {
+                        key_pressed[VERTEX_RECALCULATE] = 1;
+                        deepen = 1;
+                    }
+                }
+                // Next, finer pass, unless the view was abandoned or has
+                // moved away from the tile
+                double priority = job->stride > 1 ? chunk_priority(&schedule, key->x, key->y, job->stride / 2) : -1.0;
+                if (job->generation == generation && priority >= 0.0) {
+                    job->stride /= 2;
+                    job->refine = 1;
+                    job->priority = priority;
+                    tile->refining = generation;
+                    chunk_pool_submit(pool, job);
+                } else {
+                    if (job->generation == generation) {
+                        tile->refining = 0;
+                    }
+                    chunk_job_free(job);
+                }
             }
+            // This frame's uploads: the changed vertices, one batch of texture copies
+            frame_trace_stage(&trace, FRAME_UPLOAD);
+            vertex_first = vertex_stream_flush(&vertices, chunk_vertex_data, chunk_vertex_count + preview_vertex_count);
+            texture_stream_flush(&textures);
+            gpu_timer_end(&trace);
+            frame_trace_counters(&trace, chunks_done, chunk_pool_pending(pool), tile_cache_hits(cache), tile_cache_misses(cache));
         }
 
         // Draw
+        frame_trace_stage(&trace, FRAME_DRAW);
+        gpu_timer_begin(&gpu_timers, &trace, FRAME_DRAW);
         glClearColor(0.0, 0.0, 0.5 * (1 + sin(i++ * 0.02)), 1.0);
         glClear(GL_COLOR_BUFFER_BIT);
         /* glDrawArrays(GL_POINTS, 0, 4); */
-        glDrawArrays(GL_POINTS, 0, chunk_count);
+        // Previews first, the view's own tiles cover them
+        glDrawArrays(GL_POINTS, vertex_first + chunk_vertex_count, preview_vertex_count);
+        glDrawArrays(GL_POINTS, vertex_first, chunk_vertex_count);
+        gpu_timer_end(&trace);
+        vertex_stream_fence(&vertices);
+        texture_stream_fence(&textures);
+        frame_trace_stage(&trace, FRAME_SWAP);
         glfwSwapBuffers(window);
     }
+    if (trace_path) {
+        if (frame_trace_write(&trace, trace_path) == 0) {
+            fprintf(stderr, "Frame trace: written to %s\n", trace_path);
+        } else {
+            fprintf(stderr, "Frame trace: %s can not be written\n", trace_path);
+        }
+    }
+    frame_trace_release(&trace);
+    glDeleteQueries(GPU_TIMER_FRAMES * FRAME_STAGE_COUNT, &gpu_timers.queries[0][0]);
 
+    chunk_pool_destroy(pool);
+    fprintf(stderr, "Tile cache: %d tiles, %zu MiB, %lu hits, %lu misses\n", tile_cache_count(cache),
+            tile_cache_bytes(cache) >> 20, tile_cache_hits(cache), tile_cache_misses(cache));
+    tile_cache_destroy(cache);
+    if (store) {
+        tile_store_close(store);
+    }
+    if (reference) {
+        reference_orbit_release(reference);
+    }
     free(chunk_pixel_data);
     free(chunk_vertex_data);
+    free(order);
+    free(chunk_pending);
+    free(chunk_preview);
+    texture_stream_release(&textures);
     glDeleteTextures(1, &chunk_array_texture);
+    glDeleteTextures(1, &palette_texture);
 
     glDeleteShader(chunk_vertex_shader);
     glDeleteShader(chunk_geometry_shader);
     glDeleteShader(chunk_fragment_shader);
     glDeleteProgram(chunk_program);
-    glDeleteBuffers(1, &vertexbuffer);
+    vertex_stream_release(&vertices);
     glDeleteVertexArrays(1, &vertex_array);
     glDeleteBuffers(1, &shader_data_ubo);
 
@@ -470,34 +1348,3 @@ GLuint link_program(GLuint vertex_id, GLuint geometry_id, GLuint fragment_id) {
 	if (fragment_id != 0) glDeleteShader(fragment_id);
     return program_id;
 }
-
-
-void compute_mandelbrot_chunk(const GLdouble pos[2], const GLdouble size[2], GLsizei width_px, GLsizei height_px, GLfloat *chunk) {
-    long double step_x = size[0] / width_px;
-    long double step_y = - size[1] / height_px; // reverse Y axis
-    for (int i = 0; i < height_px; i++) {
-        long double y =  pos[1] + (i + 0.5) * step_y;
-        for (int j = 0; j < width_px; j++) {
-            long double x =  pos[0] + (j + 0.5) * step_x; // 0.5 to center the integration
-            chunk[i * width_px + j] = compute_mandelbrot(x, y);
-        }
-    }
-}
-
-#define DEPTH 1000
-GLfloat compute_mandelbrot(long double x, long double xi) {
-    long double z = 0.0;
-    long double zi = 0.0;
-    for (int i = 1; i < DEPTH; i++) {
-        long double zprev = z;
-        z = z * z - zi * zi;
-        zi = 2 * zprev * zi;
-        if (z * z + zi * zi < 4) {
-            z += x;
-            zi += xi;
-        } else {
-            return 1.0f;
-        }
-    }
-    return 0.0f;
-}
@@ -0,0 +1,941 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mandelbrot.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MANDELBROT_X86
+#endif
+
+float mandelbrot_escape_value(int n, double mag) {
+    // Smooth count: n at |w|^2 = BAILOUT^2, n + 1 at |w|^2 = BAILOUT, since
+    // |w| about squares from one iteration to the next
+    float mu = n + 1 - log2f(log2f((float)mag) / log2f((float)MANDELBROT_BAILOUT));
+    float value = log2f(1.0f + (mu > 0.0f ? mu : 0.0f)) / MANDELBROT_VALUE_OCTAVES;
+    return value < MANDELBROT_VALUE_MIN ? MANDELBROT_VALUE_MIN : value > 1.0f ? 1.0f : value;
+}
+
+double mandelbrot_escape_count(float value) {
+    return exp2(value * MANDELBROT_VALUE_OCTAVES) - 1.0;
+}
+
+// Periodicity check. An interior orbit settles on a cycle; every iteration
+// compares z to a point saved at iterations 1, 2, 4, ... (Brent), and once
+// the saved point is on the cycle and the interval has grown past its period
+// z comes back to it. Coming back within a few ulps of |z| ~ 1 means inside:
+// that is far below the pixel step of any chunk the type is picked for (see
+// PRECISION_GUARD_BITS), so escaping neighbours are not mistaken for it.
+#define MANDELBROT_PERIOD_TOLERANCE(real, epsilon) ((real)256 * (real)(epsilon) * (real)(epsilon)) // (16 ulps)^2
+
+// The escape-time loop, written once and instantiated for every numeric type
+#define MANDELBROT_POINT(name, real, epsilon)   \
+float name(real x, real xi, int depth) {        \
+    /* main cardioid and period-2 bulb */      \
+    real xq = x - (real)0.25;                   \
+    real q = xq * xq + xi * xi;                 \
+    real xb = x + 1;                            \
+    if (q * (q + xq) < (real)0.25 * xi * xi ||  \
+        xb * xb + xi * xi < (real)0.0625) {     \
+        return 0.0f;                            \
+    }                                           \
+    real z = 0.0;                               \
+    real zi = 0.0;                              \
+    real pz = 0.0;                              \
+    real pzi = 0.0;                             \
+    int save = 1;                               \
+    for (int i = 1; i < depth; i++) {           \
+        real zprev = z;                         \
+        z = z * z - zi * zi;                    \
+        zi = 2 * zprev * zi;                    \
+        if (z * z + zi * zi < MANDELBROT_BAILOUT) { \
+            z += x;                             \
+            zi += xi;                           \
+        } else {                                \
+            return mandelbrot_escape_value(i, (double)(z * z + zi * zi)); \
+        }                                       \
+        real dz = z - pz;                       \
+        real dzi = zi - pzi;                    \
+        if (dz * dz + dzi * dzi < MANDELBROT_PERIOD_TOLERANCE(real, epsilon)) { \
+            return 0.0f;                        \
+        }                                       \
+        if (i == save) {                        \
+            pz = z;                             \
+            pzi = zi;                           \
+            save *= 2;                          \
+        }                                       \
+    }                                           \
+    return 0.0f;                                \
+}
+
+MANDELBROT_POINT(compute_mandelbrot, long double, LDBL_EPSILON)
+MANDELBROT_POINT(compute_mandelbrot_double, double, DBL_EPSILON)
+static MANDELBROT_POINT(compute_mandelbrot_float, float, FLT_EPSILON)
+#ifdef MANDELBROT_HAS_QUAD
+static MANDELBROT_POINT(compute_mandelbrot_quad, __float128, 0x1p-112)
+#endif
+
+
+// A row kernel computes the pixels first, first + stride, ... (up to `end`)
+// of row `i`
+// (0 is the top row) of a chunk, and leaves the others alone. Each kernel
+// derives the pixel coordinates from pos/size in its own precision. Kernels
+// of the same precision use the same order of operations (and no FMA), so
+// the SIMD ones agree with the scalar one pixel for pixel.
+typedef void (*mandelbrot_row_fn)(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row);
+
+#define MANDELBROT_ROW(name, real, point)                                                                   \
+static void name(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) { \
+    real step_x = (real)size[0] / width_px;                                                                 \
+    real step_y = - (real)size[1] / height_px; /* reverse Y axis */                                         \
+    real y = (real)pos[1] + (i + (real)0.5) * step_y;                                                       \
+    for (int j = first; j < end; j += stride) {                                                             \
+        row[j] = point((real)pos[0] + (j + (real)0.5) * step_x, y, depth); /* 0.5 to center the integration */ \
+    }                                                                                                       \
+}
+
+MANDELBROT_ROW(mandelbrot_row_float, float, compute_mandelbrot_float)
+MANDELBROT_ROW(mandelbrot_row_double, double, compute_mandelbrot_double)
+MANDELBROT_ROW(mandelbrot_row_long_double, long double, compute_mandelbrot)
+#ifdef MANDELBROT_HAS_QUAD
+MANDELBROT_ROW(mandelbrot_row_quad, __float128, compute_mandelbrot_quad)
+#endif
+
+
+// Double-double: an unevaluated sum hi + lo of two doubles, ~106 bits of
+// mantissa at the cost of a dozen flops per operation
+struct dd {
+    double hi;
+    double lo;
+};
+
+static inline struct dd dd_from(double a) {
+    return (struct dd){ a, 0.0 };
+}
+
+static inline struct dd dd_add(struct dd a, struct dd b) {
+    double s = a.hi + b.hi;
+    double bb = s - a.hi;
+    double err = (a.hi - (s - bb)) + (b.hi - bb);
+    err += a.lo + b.lo;
+    double hi = s + err;
+    return (struct dd){ hi, err - (hi - s) };
+}
+
+static inline struct dd dd_mul(struct dd a, struct dd b) {
+    double p = a.hi * b.hi;
+    double err = fma(a.hi, b.hi, -p);
+    err += a.hi * b.lo + a.lo * b.hi;
+    double hi = p + err;
+    return (struct dd){ hi, err - (hi - p) };
+}
+
+static inline struct dd dd_mul_double(struct dd a, double b) {
+    double p = a.hi * b;
+    double err = fma(a.hi, b, -p);
+    err += a.lo * b;
+    double hi = p + err;
+    return (struct dd){ hi, err - (hi - p) };
+}
+
+static inline struct dd dd_neg(struct dd a) {
+    return (struct dd){ -a.hi, -a.lo };
+}
+
+static float compute_mandelbrot_dd(struct dd x, struct dd xi, int depth) {
+    // The interior test does not need the low parts either
+    double xq = x.hi - 0.25;
+    double q = xq * xq + xi.hi * xi.hi;
+    double xb = x.hi + 1;
+    if (q * (q + xq) < 0.25 * xi.hi * xi.hi || xb * xb + xi.hi * xi.hi < 0.0625) {
+        return 0.0f;
+    }
+    struct dd z = dd_from(0.0);
+    struct dd zi = dd_from(0.0);
+    struct dd pz = z;
+    struct dd pzi = zi;
+    int save = 1;
+    for (int i = 1; i < depth; i++) {
+        struct dd zprev = z;
+        z = dd_add(dd_mul(z, z), dd_neg(dd_mul(zi, zi)));
+        zi = dd_mul(dd_mul_double(zprev, 2.0), zi);
+        // The escape test does not need the low parts
+        if (z.hi * z.hi + zi.hi * zi.hi < MANDELBROT_BAILOUT) {
+            z = dd_add(z, x);
+            zi = dd_add(zi, xi);
+        } else {
+            return mandelbrot_escape_value(i, z.hi * z.hi + zi.hi * zi.hi);
+        }
+        // The difference is taken in full, the tolerance is far below a double ulp
+        struct dd dz = dd_add(z, dd_neg(pz));
+        struct dd dzi = dd_add(zi, dd_neg(pzi));
+        if (dz.hi * dz.hi + dzi.hi * dzi.hi < MANDELBROT_PERIOD_TOLERANCE(double, 0x1p-104)) {
+            return 0.0f;
+        }
+        if (i == save) {
+            pz = z;
+            pzi = zi;
+            save *= 2;
+        }
+    }
+    return 0.0f;
+}
+
+static struct dd dd_div_int(double a, int b) {
+    double q = a / b;
+    // One Newton correction: remainder a - q * b is exact with FMA
+    double r = fma(-q, (double)b, a);
+    double lo = r / b;
+    double hi = q + lo;
+    return (struct dd){ hi, lo - (hi - q) };
+}
+
+static void mandelbrot_row_double_double(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) {
+    struct dd step_x = dd_div_int(size[0], width_px);
+    struct dd step_y = dd_neg(dd_div_int(size[1], height_px)); // reverse Y axis
+    struct dd y = dd_add(dd_from(pos[1]), dd_mul_double(step_y, i + 0.5));
+    for (int j = first; j < end; j += stride) {
+        struct dd x = dd_add(dd_from(pos[0]), dd_mul_double(step_x, j + 0.5));
+        row[j] = compute_mandelbrot_dd(x, y, depth);
+    }
+}
+
+
+#ifdef MANDELBROT_X86
+// Lane refill: a SIMD kernel does not wait for the slowest lane of a group
+// of pixels. A lane whose pixel is done (escaped, periodic or at the limit)
+// takes the next pixel of the row, so every lane stays busy until the row
+// runs out. Between vector loops the state of each lane lives in these
+// arrays; a kernel spills to them only when a lane finishes. Every lane
+// follows MANDELBROT_POINT step by step, in the same type and order.
+#define MANDELBROT_LANES_MAX 16
+
+#define MANDELBROT_LANES(suffix, real)                                          \
+struct mandelbrot_lanes_##suffix {                                              \
+    real cx[MANDELBROT_LANES_MAX];                                              \
+    real z[MANDELBROT_LANES_MAX];                                               \
+    real zi[MANDELBROT_LANES_MAX];                                              \
+    real pz[MANDELBROT_LANES_MAX];      /* periodicity check point */           \
+    real pzi[MANDELBROT_LANES_MAX];                                             \
+    real n[MANDELBROT_LANES_MAX];       /* iteration the lane is at */          \
+    real save[MANDELBROT_LANES_MAX];    /* iteration saving the next point */   \
+    real mag[MANDELBROT_LANES_MAX];     /* |w|^2 of the last iteration */       \
+    real live[MANDELBROT_LANES_MAX];    /* 1 while the lane has a pixel */      \
+    int px[MANDELBROT_LANES_MAX];       /* its column */                        \
+    real pos_x;                                                                 \
+    real step_x;                                                                \
+    real ci;                                                                    \
+    int next;                           /* column of the next pixel */          \
+    int end;                                                                    \
+    int stride;                                                                 \
+    int depth;                                                                  \
+    float *row;                                                                 \
+};                                                                              \
+                                                                                \
+/* Coordinates as in MANDELBROT_ROW */                                          \
+static void mandelbrot_lanes_##suffix##_init(struct mandelbrot_lanes_##suffix *l, const double pos[2], const double size[2], \
+        int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) { \
+    l->pos_x = (real)pos[0];                                                    \
+    l->step_x = (real)size[0] / width_px;                                       \
+    real step_y = - (real)size[1] / height_px;                                  \
+    l->ci = (real)pos[1] + (i + (real)0.5) * step_y;                            \
+    l->next = first;                                                            \
+    l->end = end;                                                               \
+    l->stride = stride;                                                         \
+    l->depth = depth;                                                           \
+    l->row = row;                                                               \
+}                                                                               \
+                                                                                \
+/* Gives lane k the next pixel the cardioid/bulb test does not decide. */      \
+/* Returns 0 when the row is done: the lane idles at 0, which never ends */    \
+static int mandelbrot_lanes_##suffix##_fill(struct mandelbrot_lanes_##suffix *l, int k) { \
+    l->z[k] = 0;                                                                \
+    l->zi[k] = 0;                                                               \
+    l->pz[k] = 0;                                                               \
+    l->pzi[k] = 0;                                                              \
+    l->n[k] = 1;                                                                \
+    l->save[k] = 1;                                                             \
+    l->mag[k] = 0;                                                              \
+    while (l->next < l->end) {                                                  \
+        int j = l->next;                                                        \
+        l->next += l->stride;                                                   \
+        real x = l->pos_x + (j + (real)0.5) * l->step_x;                        \
+        real xi = l->ci;                                                        \
+        real xq = x - (real)0.25;                                               \
+        real q = xq * xq + xi * xi;                                             \
+        real xb = x + 1;                                                        \
+        if (l->depth <= 1 || q * (q + xq) < (real)0.25 * xi * xi ||             \
+            xb * xb + xi * xi < (real)0.0625) {                                 \
+            l->row[j] = 0.0f;                                                   \
+            continue;                                                           \
+        }                                                                       \
+        l->cx[k] = x;                                                           \
+        l->live[k] = 1;                                                         \
+        l->px[k] = j;                                                           \
+        return 1;                                                               \
+    }                                                                           \
+    l->cx[k] = 0;                                                               \
+    l->live[k] = 0;                                                             \
+    l->px[k] = -1;                                                              \
+    return 0;                                                                   \
+}                                                                               \
+                                                                                \
+/* Writes the pixels of the `done` lanes (a bit per lane) and refills them. */ \
+/* Returns 0 once every lane idles */                                          \
+static int mandelbrot_lanes_##suffix##_refill(struct mandelbrot_lanes_##suffix *l, int width, int done) { \
+    int live = 0;                                                               \
+    for (int k = 0; k < width; k++) {                                           \
+        if ((done >> k) & 1) {                                                  \
+            /* n is past the last iteration; NaN escapes, as in the loop */    \
+            l->row[l->px[k]] = l->mag[k] < MANDELBROT_BAILOUT ? 0.0f :          \
+                    mandelbrot_escape_value((int)l->n[k] - 1, (double)l->mag[k]); \
+            mandelbrot_lanes_##suffix##_fill(l, k);                             \
+        }                                                                       \
+        live |= l->px[k] >= 0;                                                  \
+    }                                                                           \
+    return live;                                                                \
+}                                                                               \
+                                                                                \
+static int mandelbrot_lanes_##suffix##_start(struct mandelbrot_lanes_##suffix *l, int width) { \
+    int live = 0;                                                               \
+    for (int k = 0; k < width; k++) {                                           \
+        live |= mandelbrot_lanes_##suffix##_fill(l, k);                         \
+    }                                                                           \
+    return live;                                                                \
+}
+
+MANDELBROT_LANES(float, float)
+MANDELBROT_LANES(double, double)
+
+// The SIMD kernels: a vector loop runs until some lane finishes, then the
+// lanes are refilled. A lane finishes when it escapes (this takes priority,
+// as in MANDELBROT_POINT), comes back to its saved point, or reaches the
+// limit. No FMA: it would round differently from the scalar kernel.
+__attribute__((target("sse2")))
+static void mandelbrot_row_double_sse2(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) {
+    const __m128d tolerance = _mm_set1_pd(MANDELBROT_PERIOD_TOLERANCE(double, DBL_EPSILON));
+    const __m128d bailout = _mm_set1_pd(MANDELBROT_BAILOUT);
+    const __m128d two = _mm_set1_pd(2.0);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d limit = _mm_set1_pd(depth);
+    struct mandelbrot_lanes_double l;
+    mandelbrot_lanes_double_init(&l, pos, size, width_px, height_px, depth, i, first, end, stride, row);
+    const __m128d ci = _mm_set1_pd(l.ci);
+    int live = mandelbrot_lanes_double_start(&l, 2);
+    while (live) {
+        __m128d c = _mm_loadu_pd(l.cx);
+        __m128d z = _mm_loadu_pd(l.z);
+        __m128d zi = _mm_loadu_pd(l.zi);
+        __m128d pz = _mm_loadu_pd(l.pz);
+        __m128d pzi = _mm_loadu_pd(l.pzi);
+        __m128d n = _mm_loadu_pd(l.n);
+        __m128d save = _mm_loadu_pd(l.save);
+        __m128d lanes = _mm_cmpneq_pd(_mm_loadu_pd(l.live), _mm_setzero_pd());
+        __m128d mag;
+        int done;
+        do {
+            __m128d zz = _mm_sub_pd(_mm_mul_pd(z, z), _mm_mul_pd(zi, zi));
+            zi = _mm_mul_pd(_mm_mul_pd(two, z), zi);
+            z = zz;
+            mag = _mm_add_pd(_mm_mul_pd(z, z), _mm_mul_pd(zi, zi));
+            __m128d finished = _mm_cmpnlt_pd(mag, bailout);
+            z = _mm_add_pd(z, c);
+            zi = _mm_add_pd(zi, ci);
+            __m128d dz = _mm_sub_pd(z, pz);
+            __m128d dzi = _mm_sub_pd(zi, pzi);
+            finished = _mm_or_pd(finished, _mm_cmplt_pd(_mm_add_pd(_mm_mul_pd(dz, dz), _mm_mul_pd(dzi, dzi)), tolerance));
+            __m128d saving = _mm_cmpeq_pd(n, save);
+            pz = _mm_or_pd(_mm_and_pd(saving, z), _mm_andnot_pd(saving, pz));
+            pzi = _mm_or_pd(_mm_and_pd(saving, zi), _mm_andnot_pd(saving, pzi));
+            save = _mm_add_pd(save, _mm_and_pd(saving, save));
+            n = _mm_add_pd(n, one);
+            finished = _mm_or_pd(finished, _mm_cmpge_pd(n, limit));
+            done = _mm_movemask_pd(_mm_and_pd(finished, lanes));
+        } while (!done);
+        _mm_storeu_pd(l.z, z);
+        _mm_storeu_pd(l.zi, zi);
+        _mm_storeu_pd(l.pz, pz);
+        _mm_storeu_pd(l.pzi, pzi);
+        _mm_storeu_pd(l.n, n);
+        _mm_storeu_pd(l.save, save);
+        _mm_storeu_pd(l.mag, mag);
+        live = mandelbrot_lanes_double_refill(&l, 2, done);
+    }
+}
+
+__attribute__((target("sse2")))
+static void mandelbrot_row_float_sse2(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) {
+    const __m128 tolerance = _mm_set1_ps(MANDELBROT_PERIOD_TOLERANCE(float, FLT_EPSILON));
+    const __m128 bailout = _mm_set1_ps(MANDELBROT_BAILOUT);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 limit = _mm_set1_ps(depth);
+    struct mandelbrot_lanes_float l;
+    mandelbrot_lanes_float_init(&l, pos, size, width_px, height_px, depth, i, first, end, stride, row);
+    const __m128 ci = _mm_set1_ps(l.ci);
+    int live = mandelbrot_lanes_float_start(&l, 4);
+    while (live) {
+        __m128 c = _mm_loadu_ps(l.cx);
+        __m128 z = _mm_loadu_ps(l.z);
+        __m128 zi = _mm_loadu_ps(l.zi);
+        __m128 pz = _mm_loadu_ps(l.pz);
+        __m128 pzi = _mm_loadu_ps(l.pzi);
+        __m128 n = _mm_loadu_ps(l.n);
+        __m128 save = _mm_loadu_ps(l.save);
+        __m128 lanes = _mm_cmpneq_ps(_mm_loadu_ps(l.live), _mm_setzero_ps());
+        __m128 mag;
+        int done;
+        do {
+            __m128 zz = _mm_sub_ps(_mm_mul_ps(z, z), _mm_mul_ps(zi, zi));
+            zi = _mm_mul_ps(_mm_mul_ps(two, z), zi);
+            z = zz;
+            mag = _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(zi, zi));
+            __m128 finished = _mm_cmpnlt_ps(mag, bailout);
+            z = _mm_add_ps(z, c);
+            zi = _mm_add_ps(zi, ci);
+            __m128 dz = _mm_sub_ps(z, pz);
+            __m128 dzi = _mm_sub_ps(zi, pzi);
+            finished = _mm_or_ps(finished, _mm_cmplt_ps(_mm_add_ps(_mm_mul_ps(dz, dz), _mm_mul_ps(dzi, dzi)), tolerance));
+            __m128 saving = _mm_cmpeq_ps(n, save);
+            pz = _mm_or_ps(_mm_and_ps(saving, z), _mm_andnot_ps(saving, pz));
+            pzi = _mm_or_ps(_mm_and_ps(saving, zi), _mm_andnot_ps(saving, pzi));
+            save = _mm_add_ps(save, _mm_and_ps(saving, save));
+            n = _mm_add_ps(n, one);
+            finished = _mm_or_ps(finished, _mm_cmpge_ps(n, limit));
+            done = _mm_movemask_ps(_mm_and_ps(finished, lanes));
+        } while (!done);
+        _mm_storeu_ps(l.z, z);
+        _mm_storeu_ps(l.zi, zi);
+        _mm_storeu_ps(l.pz, pz);
+        _mm_storeu_ps(l.pzi, pzi);
+        _mm_storeu_ps(l.n, n);
+        _mm_storeu_ps(l.save, save);
+        _mm_storeu_ps(l.mag, mag);
+        live = mandelbrot_lanes_float_refill(&l, 4, done);
+    }
+}
+
+__attribute__((target("avx2")))
+static void mandelbrot_row_double_avx2(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) {
+    const __m256d tolerance = _mm256_set1_pd(MANDELBROT_PERIOD_TOLERANCE(double, DBL_EPSILON));
+    const __m256d bailout = _mm256_set1_pd(MANDELBROT_BAILOUT);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d limit = _mm256_set1_pd(depth);
+    struct mandelbrot_lanes_double l;
+    mandelbrot_lanes_double_init(&l, pos, size, width_px, height_px, depth, i, first, end, stride, row);
+    const __m256d ci = _mm256_set1_pd(l.ci);
+    int live = mandelbrot_lanes_double_start(&l, 4);
+    while (live) {
+        __m256d c = _mm256_loadu_pd(l.cx);
+        __m256d z = _mm256_loadu_pd(l.z);
+        __m256d zi = _mm256_loadu_pd(l.zi);
+        __m256d pz = _mm256_loadu_pd(l.pz);
+        __m256d pzi = _mm256_loadu_pd(l.pzi);
+        __m256d n = _mm256_loadu_pd(l.n);
+        __m256d save = _mm256_loadu_pd(l.save);
+        __m256d lanes = _mm256_cmp_pd(_mm256_loadu_pd(l.live), _mm256_setzero_pd(), _CMP_NEQ_OQ);
+        __m256d mag;
+        int done;
+        do {
+            __m256d zz = _mm256_sub_pd(_mm256_mul_pd(z, z), _mm256_mul_pd(zi, zi));
+            zi = _mm256_mul_pd(_mm256_mul_pd(two, z), zi);
+            z = zz;
+            mag = _mm256_add_pd(_mm256_mul_pd(z, z), _mm256_mul_pd(zi, zi));
+            __m256d finished = _mm256_cmp_pd(mag, bailout, _CMP_NLT_UQ);
+            z = _mm256_add_pd(z, c);
+            zi = _mm256_add_pd(zi, ci);
+            __m256d dz = _mm256_sub_pd(z, pz);
+            __m256d dzi = _mm256_sub_pd(zi, pzi);
+            finished = _mm256_or_pd(finished, _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(dz, dz), _mm256_mul_pd(dzi, dzi)), tolerance, _CMP_LT_OQ));
+            __m256d saving = _mm256_cmp_pd(n, save, _CMP_EQ_OQ);
+            pz = _mm256_blendv_pd(pz, z, saving);
+            pzi = _mm256_blendv_pd(pzi, zi, saving);
+            save = _mm256_add_pd(save, _mm256_and_pd(saving, save));
+            n = _mm256_add_pd(n, one);
+            finished = _mm256_or_pd(finished, _mm256_cmp_pd(n, limit, _CMP_GE_OQ));
+            done = _mm256_movemask_pd(_mm256_and_pd(finished, lanes));
+        } while (!done);
+        _mm256_storeu_pd(l.z, z);
+        _mm256_storeu_pd(l.zi, zi);
+        _mm256_storeu_pd(l.pz, pz);
+        _mm256_storeu_pd(l.pzi, pzi);
+        _mm256_storeu_pd(l.n, n);
+        _mm256_storeu_pd(l.save, save);
+        _mm256_storeu_pd(l.mag, mag);
+        live = mandelbrot_lanes_double_refill(&l, 4, done);
+    }
+}
+
+__attribute__((target("avx2")))
+static void mandelbrot_row_float_avx2(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) {
+    const __m256 tolerance = _mm256_set1_ps(MANDELBROT_PERIOD_TOLERANCE(float, FLT_EPSILON));
+    const __m256 bailout = _mm256_set1_ps(MANDELBROT_BAILOUT);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 limit = _mm256_set1_ps(depth);
+    struct mandelbrot_lanes_float l;
+    mandelbrot_lanes_float_init(&l, pos, size, width_px, height_px, depth, i, first, end, stride, row);
+    const __m256 ci = _mm256_set1_ps(l.ci);
+    int live = mandelbrot_lanes_float_start(&l, 8);
+    while (live) {
+        __m256 c = _mm256_loadu_ps(l.cx);
+        __m256 z = _mm256_loadu_ps(l.z);
+        __m256 zi = _mm256_loadu_ps(l.zi);
+        __m256 pz = _mm256_loadu_ps(l.pz);
+        __m256 pzi = _mm256_loadu_ps(l.pzi);
+        __m256 n = _mm256_loadu_ps(l.n);
+        __m256 save = _mm256_loadu_ps(l.save);
+        __m256 lanes = _mm256_cmp_ps(_mm256_loadu_ps(l.live), _mm256_setzero_ps(), _CMP_NEQ_OQ);
+        __m256 mag;
+        int done;
+        do {
+            __m256 zz = _mm256_sub_ps(_mm256_mul_ps(z, z), _mm256_mul_ps(zi, zi));
+            zi = _mm256_mul_ps(_mm256_mul_ps(two, z), zi);
+            z = zz;
+            mag = _mm256_add_ps(_mm256_mul_ps(z, z), _mm256_mul_ps(zi, zi));
+            __m256 finished = _mm256_cmp_ps(mag, bailout, _CMP_NLT_UQ);
+            z = _mm256_add_ps(z, c);
+            zi = _mm256_add_ps(zi, ci);
+            __m256 dz = _mm256_sub_ps(z, pz);
+            __m256 dzi = _mm256_sub_ps(zi, pzi);
+            finished = _mm256_or_ps(finished, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(dz, dz), _mm256_mul_ps(dzi, dzi)), tolerance, _CMP_LT_OQ));
+            __m256 saving = _mm256_cmp_ps(n, save, _CMP_EQ_OQ);
+            pz = _mm256_blendv_ps(pz, z, saving);
+            pzi = _mm256_blendv_ps(pzi, zi, saving);
+            save = _mm256_add_ps(save, _mm256_and_ps(saving, save));
+            n = _mm256_add_ps(n, one);
+            finished = _mm256_or_ps(finished, _mm256_cmp_ps(n, limit, _CMP_GE_OQ));
+            done = _mm256_movemask_ps(_mm256_and_ps(finished, lanes));
+        } while (!done);
+        _mm256_storeu_ps(l.z, z);
+        _mm256_storeu_ps(l.zi, zi);
+        _mm256_storeu_ps(l.pz, pz);
+        _mm256_storeu_ps(l.pzi, pzi);
+        _mm256_storeu_ps(l.n, n);
+        _mm256_storeu_ps(l.save, save);
+        _mm256_storeu_ps(l.mag, mag);
+        live = mandelbrot_lanes_float_refill(&l, 8, done);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void mandelbrot_row_double_avx512(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) {
+    const __m512d tolerance = _mm512_set1_pd(MANDELBROT_PERIOD_TOLERANCE(double, DBL_EPSILON));
+    const __m512d bailout = _mm512_set1_pd(MANDELBROT_BAILOUT);
+    const __m512d two = _mm512_set1_pd(2.0);
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d limit = _mm512_set1_pd(depth);
+    struct mandelbrot_lanes_double l;
+    mandelbrot_lanes_double_init(&l, pos, size, width_px, height_px, depth, i, first, end, stride, row);
+    const __m512d ci = _mm512_set1_pd(l.ci);
+    int live = mandelbrot_lanes_double_start(&l, 8);
+    while (live) {
+        __m512d c = _mm512_loadu_pd(l.cx);
+        __m512d z = _mm512_loadu_pd(l.z);
+        __m512d zi = _mm512_loadu_pd(l.zi);
+        __m512d pz = _mm512_loadu_pd(l.pz);
+        __m512d pzi = _mm512_loadu_pd(l.pzi);
+        __m512d n = _mm512_loadu_pd(l.n);
+        __m512d save = _mm512_loadu_pd(l.save);
+        __mmask8 lanes = _mm512_cmp_pd_mask(_mm512_loadu_pd(l.live), _mm512_setzero_pd(), _CMP_NEQ_OQ);
+        __m512d mag;
+        __mmask8 done;
+        do {
+            __m512d zz = _mm512_sub_pd(_mm512_mul_pd(z, z), _mm512_mul_pd(zi, zi));
+            zi = _mm512_mul_pd(_mm512_mul_pd(two, z), zi);
+            z = zz;
+            mag = _mm512_add_pd(_mm512_mul_pd(z, z), _mm512_mul_pd(zi, zi));
+            __mmask8 finished = _mm512_cmp_pd_mask(mag, bailout, _CMP_NLT_UQ);
+            z = _mm512_add_pd(z, c);
+            zi = _mm512_add_pd(zi, ci);
+            __m512d dz = _mm512_sub_pd(z, pz);
+            __m512d dzi = _mm512_sub_pd(zi, pzi);
+            finished |= _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(dz, dz), _mm512_mul_pd(dzi, dzi)), tolerance, _CMP_LT_OQ);
+            __mmask8 saving = _mm512_cmp_pd_mask(n, save, _CMP_EQ_OQ);
+            pz = _mm512_mask_mov_pd(pz, saving, z);
+            pzi = _mm512_mask_mov_pd(pzi, saving, zi);
+            save = _mm512_mask_add_pd(save, saving, save, save);
+            n = _mm512_add_pd(n, one);
+            finished |= _mm512_cmp_pd_mask(n, limit, _CMP_GE_OQ);
+            done = finished & lanes;
+        } while (!done);
+        _mm512_storeu_pd(l.z, z);
+        _mm512_storeu_pd(l.zi, zi);
+        _mm512_storeu_pd(l.pz, pz);
+        _mm512_storeu_pd(l.pzi, pzi);
+        _mm512_storeu_pd(l.n, n);
+        _mm512_storeu_pd(l.save, save);
+        _mm512_storeu_pd(l.mag, mag);
+        live = mandelbrot_lanes_double_refill(&l, 8, done);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void mandelbrot_row_float_avx512(const double pos[2], const double size[2], int width_px, int height_px, int depth, int i, int first, int end, int stride, float *row) {
+    const __m512 tolerance = _mm512_set1_ps(MANDELBROT_PERIOD_TOLERANCE(float, FLT_EPSILON));
+    const __m512 bailout = _mm512_set1_ps(MANDELBROT_BAILOUT);
+    const __m512 two = _mm512_set1_ps(2.0f);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 limit = _mm512_set1_ps(depth);
+    struct mandelbrot_lanes_float l;
+    mandelbrot_lanes_float_init(&l, pos, size, width_px, height_px, depth, i, first, end, stride, row);
+    const __m512 ci = _mm512_set1_ps(l.ci);
+    int live = mandelbrot_lanes_float_start(&l, 16);
+    while (live) {
+        __m512 c = _mm512_loadu_ps(l.cx);
+        __m512 z = _mm512_loadu_ps(l.z);
+        __m512 zi = _mm512_loadu_ps(l.zi);
+        __m512 pz = _mm512_loadu_ps(l.pz);
+        __m512 pzi = _mm512_loadu_ps(l.pzi);
+        __m512 n = _mm512_loadu_ps(l.n);
+        __m512 save = _mm512_loadu_ps(l.save);
+        __mmask16 lanes = _mm512_cmp_ps_mask(_mm512_loadu_ps(l.live), _mm512_setzero_ps(), _CMP_NEQ_OQ);
+        __m512 mag;
+        __mmask16 done;
+        do {
+            __m512 zz = _mm512_sub_ps(_mm512_mul_ps(z, z), _mm512_mul_ps(zi, zi));
+            zi = _mm512_mul_ps(_mm512_mul_ps(two, z), zi);
+            z = zz;
+            mag = _mm512_add_ps(_mm512_mul_ps(z, z), _mm512_mul_ps(zi, zi));
+            __mmask16 finished = _mm512_cmp_ps_mask(mag, bailout, _CMP_NLT_UQ);
+            z = _mm512_add_ps(z, c);
+            zi = _mm512_add_ps(zi, ci);
+            __m512 dz = _mm512_sub_ps(z, pz);
+            __m512 dzi = _mm512_sub_ps(zi, pzi);
+            finished |= _mm512_cmp_ps_mask(_mm512_add_ps(_mm512_mul_ps(dz, dz), _mm512_mul_ps(dzi, dzi)), tolerance, _CMP_LT_OQ);
+            __mmask16 saving = _mm512_cmp_ps_mask(n, save, _CMP_EQ_OQ);
+            pz = _mm512_mask_mov_ps(pz, saving, z);
+            pzi = _mm512_mask_mov_ps(pzi, saving, zi);
+            save = _mm512_mask_add_ps(save, saving, save, save);
+            n = _mm512_add_ps(n, one);
+            finished |= _mm512_cmp_ps_mask(n, limit, _CMP_GE_OQ);
+            done = finished & lanes;
+        } while (!done);
+        _mm512_storeu_ps(l.z, z);
+        _mm512_storeu_ps(l.zi, zi);
+        _mm512_storeu_ps(l.pz, pz);
+        _mm512_storeu_ps(l.pzi, pzi);
+        _mm512_storeu_ps(l.n, n);
+        _mm512_storeu_ps(l.save, save);
+        _mm512_storeu_ps(l.mag, mag);
+        live = mandelbrot_lanes_float_refill(&l, 16, done);
+    }
+}
+#endif
+
+// SIMD kernels exist for float and double only; the wider types are scalar
+static const struct {
+    const char *name;
+    mandelbrot_row_fn row_float;
+    mandelbrot_row_fn row_double;
+} mandelbrot_kernels[] = {
+#ifdef MANDELBROT_X86
+    { "avx512", mandelbrot_row_float_avx512, mandelbrot_row_double_avx512 },
+    { "avx2", mandelbrot_row_float_avx2, mandelbrot_row_double_avx2 },
+    { "sse2", mandelbrot_row_float_sse2, mandelbrot_row_double_sse2 },
+#endif
+    { "scalar", mandelbrot_row_float, mandelbrot_row_double },
+};
+#define MANDELBROT_KERNEL_COUNT (int)(sizeof(mandelbrot_kernels) / sizeof(mandelbrot_kernels[0]))
+
+static const struct {
+    const char *name;
+    int mantissa_bits;
+} mandelbrot_precisions[PRECISION_COUNT] = {
+    [PRECISION_FLOAT] = { "float", FLT_MANT_DIG },
+    [PRECISION_DOUBLE] = { "double", DBL_MANT_DIG },
+    [PRECISION_LONG_DOUBLE] = { "long double", LDBL_MANT_DIG },
+    [PRECISION_DOUBLE_DOUBLE] = { "double-double", 2 * DBL_MANT_DIG },
+#ifdef MANDELBROT_HAS_QUAD
+    [PRECISION_QUAD] = { "quad", 113 },
+#endif
+};
+
+static int mandelbrot_kernel_supported(int idx) {
+#ifdef MANDELBROT_X86
+    const char *name = mandelbrot_kernels[idx].name;
+    if (strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    (void)idx;
+    return 1;
+}
+
+static pthread_once_t mandelbrot_kernel_once = PTHREAD_ONCE_INIT;
+static int mandelbrot_kernel_idx = MANDELBROT_KERNEL_COUNT - 1;
+static int mandelbrot_forced_precision = -1;
+static int mandelbrot_subdivide = 0;
+
+// Pick the widest kernel the CPU supports. MANDELBROT_KERNEL=<name> in the
+// environment forces a (supported) kernel, e.g. to compare against scalar;
+// MANDELBROT_PRECISION=<name> forces one numeric type for every chunk;
+// MANDELBROT_SUBDIVIDE=1 fills rectangles inside the set (see mandelbrot_pass)
+static void mandelbrot_kernel_select(void) {
+#ifdef MANDELBROT_X86
+    __builtin_cpu_init();
+#endif
+    const char *forced = getenv("MANDELBROT_KERNEL");
+    int found = 0;
+    for (int i = 0; i < MANDELBROT_KERNEL_COUNT && !found; i++) {
+        if (forced && strcmp(forced, mandelbrot_kernels[i].name) != 0) continue;
+        if (mandelbrot_kernel_supported(i)) {
+            mandelbrot_kernel_idx = i;
+            found = 1;
+        }
+    }
+    if (forced && !found) {
+        fprintf(stderr, "[MANDELBROT] kernel '%s' is not available, using %s\n",
+                forced, mandelbrot_kernels[mandelbrot_kernel_idx].name);
+    }
+    const char *precision = getenv("MANDELBROT_PRECISION");
+    for (int i = 0; precision && i < PRECISION_COUNT; i++) {
+        if (mandelbrot_precisions[i].name && strcmp(precision, mandelbrot_precisions[i].name) == 0) {
+            mandelbrot_forced_precision = i;
+        }
+    }
+    if (precision && mandelbrot_forced_precision < 0) {
+        fprintf(stderr, "[MANDELBROT] unknown precision '%s', choosing by zoom\n", precision);
+    }
+    const char *subdivide = getenv("MANDELBROT_SUBDIVIDE");
+    if (subdivide && strcmp(subdivide, "1") == 0) {
+        mandelbrot_subdivide = 1;
+    }
+}
+
+const char *mandelbrot_kernel_name(void) {
+    pthread_once(&mandelbrot_kernel_once, mandelbrot_kernel_select);
+    return mandelbrot_kernels[mandelbrot_kernel_idx].name;
+}
+
+int mandelbrot_precision_forced(void) {
+    pthread_once(&mandelbrot_kernel_once, mandelbrot_kernel_select);
+    return mandelbrot_forced_precision >= 0;
+}
+
+const char *mandelbrot_precision_name(enum mandelbrot_precision precision) {
+    return mandelbrot_precisions[precision].name;
+}
+
+
+enum mandelbrot_precision mandelbrot_select_precision(const double pos[2], const double size[2], int width_px, int height_px) {
+    pthread_once(&mandelbrot_kernel_once, mandelbrot_kernel_select);
+    if (mandelbrot_forced_precision >= 0) {
+        return (enum mandelbrot_precision)mandelbrot_forced_precision;
+    }
+    // Orbits live in |z| <= 2, so that is the smallest magnitude to resolve
+    // the pixel step against
+    double magnitude = 2.0;
+    magnitude = fmax(magnitude, fabs(pos[0]));
+    magnitude = fmax(magnitude, fabs(pos[0] + size[0]));
+    magnitude = fmax(magnitude, fabs(pos[1]));
+    magnitude = fmax(magnitude, fabs(pos[1] - size[1]));
+    double step = fmin(size[0] / width_px, size[1] / height_px);
+    double bits = log2(magnitude / step) + PRECISION_GUARD_BITS;
+    enum mandelbrot_precision best = PRECISION_FLOAT;
+    for (int i = 0; i < PRECISION_COUNT; i++) {
+        if (!mandelbrot_precisions[i].name) continue;
+        best = (enum mandelbrot_precision)i;
+        if (mandelbrot_precisions[i].mantissa_bits >= bits) break;
+    }
+    return best;
+}
+
+static void mandelbrot_fill_blocks(int width_px, int height_px, int stride, float *chunk) {
+    if (stride == 1) {
+        return;
+    }
+    for (int i = 0; i < height_px; i++) {
+        const float *samples = &chunk[(i - i % stride) * width_px];
+        for (int j = 0; j < width_px; j++) {
+            if (i % stride || j % stride) {
+                chunk[i * width_px + j] = samples[j - j % stride];
+            }
+        }
+    }
+}
+
+
+// Mariani-Silver subdivision. The samples of a pass form a lattice (every
+// stride-th row and column); a rectangle of it whose border samples are all
+// inside the set is taken to be inside as a whole, as the set is connected
+// and has no holes. Only uniformly inside borders are filled: an escaped
+// border can enclose a minibrot. The samples are no proof, a filament can
+// cross the border between two of them, so the filled pixels can differ
+// from iterating each: off unless asked for.
+#define MANDELBROT_SUBDIVIDE_MIN 16 // lattice steps, smaller rectangles are computed through
+
+struct mandelbrot_pass_state {
+    mandelbrot_span_fn span;
+    const void *ctx;
+    int width_px;
+    int stride;
+    float *chunk;
+    int lattice_w;
+    unsigned char *done;    // per lattice sample
+    const struct mandelbrot_cancel *cancel;
+    int cancelled;
+};
+
+// Checked before every kernel call: one lattice row at most is wasted
+static int mandelbrot_pass_cancelled(struct mandelbrot_pass_state *s) {
+    if (!s->cancelled && s->cancel && atomic_load(s->cancel->generation) != s->cancel->expected) {
+        s->cancelled = 1;
+    }
+    return s->cancelled;
+}
+
+static float *mandelbrot_sample(const struct mandelbrot_pass_state *s, int a, int b) {
+    return &s->chunk[b * s->stride * s->width_px + a * s->stride];
+}
+
+// Compute the missing samples a0 .. a1 of lattice row b. Runs go to the
+// kernel in one call, also runs with every other sample there already (the
+// rows of a refining pass).
+static void mandelbrot_pass_row(struct mandelbrot_pass_state *s, int b, int a0, int a1) {
+    const unsigned char *done = &s->done[b * s->lattice_w];
+    float *row = &s->chunk[b * s->stride * s->width_px];
+    int a = a0;
+    while (a <= a1 && !mandelbrot_pass_cancelled(s)) {
+        if (done[a]) {
+            a++;
+            continue;
+        }
+        int step = a + 1 <= a1 && !done[a + 1] ? 1 : 2;
+        int e = a;
+        while (e + step <= a1 && !done[e + step] && (step == 1 || done[e + 1])) {
+            e += step;
+        }
+        s->span(s->ctx, b * s->stride, a * s->stride, e * s->stride + 1, step * s->stride, row);
+        for (int k = a; k <= e; k += step) {
+            s->done[b * s->lattice_w + k] = 1;
+        }
+        a = e + 1;
+    }
+}
+
+static void mandelbrot_pass_column(struct mandelbrot_pass_state *s, int a, int b0, int b1) {
+    for (int b = b0; b <= b1 && !mandelbrot_pass_cancelled(s); b++) {
+        if (!s->done[b * s->lattice_w + a]) {
+            s->span(s->ctx, b * s->stride, a * s->stride, a * s->stride + 1, s->stride, &s->chunk[b * s->stride * s->width_px]);
+            s->done[b * s->lattice_w + a] = 1;
+        }
+    }
+}
+
+// Lattice rectangle a0 .. a1 x b0 .. b1, borders included
+static void mandelbrot_pass_rect(struct mandelbrot_pass_state *s, int a0, int b0, int a1, int b1) {
+    mandelbrot_pass_row(s, b0, a0, a1);
+    mandelbrot_pass_row(s, b1, a0, a1);
+    mandelbrot_pass_column(s, a0, b0 + 1, b1 - 1);
+    mandelbrot_pass_column(s, a1, b0 + 1, b1 - 1);
+    if (s->cancelled) {
+        return;
+    }
+    if (a1 - a0 <= MANDELBROT_SUBDIVIDE_MIN || b1 - b0 <= MANDELBROT_SUBDIVIDE_MIN) {
+        for (int b = b0 + 1; b < b1; b++) {
+            mandelbrot_pass_row(s, b, a0 + 1, a1 - 1);
+        }
+        return;
+    }
+    // Samples inside known from the previous pass have to agree too
+    int inside = 1;
+    for (int a = a0; a <= a1 && inside; a++) {
+        inside = *mandelbrot_sample(s, a, b0) == 0.0f && *mandelbrot_sample(s, a, b1) == 0.0f;
+    }
+    for (int b = b0 + 1; b < b1 && inside; b++) {
+        for (int a = a0; a <= a1 && inside; a++) {
+            inside = !s->done[b * s->lattice_w + a] || *mandelbrot_sample(s, a, b) == 0.0f;
+        }
+    }
+    if (inside) {
+        for (int b = b0 + 1; b < b1; b++) {
+            for (int a = a0 + 1; a < a1; a++) {
+                *mandelbrot_sample(s, a, b) = 0.0f;
+                s->done[b * s->lattice_w + a] = 1;
+            }
+        }
+        return;
+    }
+    // Halves share the middle line, computed once
+    if (a1 - a0 >= b1 - b0) {
+        int am = (a0 + a1) / 2;
+        mandelbrot_pass_rect(s, a0, b0, am, b1);
+        mandelbrot_pass_rect(s, am, b0, a1, b1);
+    } else {
+        int bm = (b0 + b1) / 2;
+        mandelbrot_pass_rect(s, a0, b0, a1, bm);
+        mandelbrot_pass_rect(s, a0, bm, a1, b1);
+    }
+}
+
+
+int mandelbrot_pass(mandelbrot_span_fn span, const void *ctx, int width_px, int height_px, int stride, int refine,
+        const struct mandelbrot_cancel *cancel, float *chunk) {
+    pthread_once(&mandelbrot_kernel_once, mandelbrot_kernel_select);
+    struct mandelbrot_pass_state s = { span, ctx, width_px, stride, chunk, (width_px + stride - 1) / stride, NULL, cancel, 0 };
+    int lattice_h = (height_px + stride - 1) / stride;
+    s.done = (unsigned char*)calloc(s.lattice_w * lattice_h, 1);
+    if (refine) {
+        for (int b = 0; b < lattice_h; b += 2) {
+            for (int a = 0; a < s.lattice_w; a += 2) {
+                s.done[b * s.lattice_w + a] = 1;
+            }
+        }
+    }
+    if (mandelbrot_subdivide) {
+        mandelbrot_pass_rect(&s, 0, 0, s.lattice_w - 1, lattice_h - 1);
+    } else {
+        for (int b = 0; b < lattice_h; b++) {
+            mandelbrot_pass_row(&s, b, 0, s.lattice_w - 1);
+        }
+    }
+    free(s.done);
+    if (s.cancelled) {
+        return -1;
+    }
+    mandelbrot_fill_blocks(width_px, height_px, stride, chunk);
+    return 0;
+}
+
+
+struct mandelbrot_row_ctx {
+    mandelbrot_row_fn row;
+    const double *pos;
+    const double *size;
+    int width_px;
+    int height_px;
+    int depth;
+};
+
+static void mandelbrot_row_span(const void *ctx, int i, int first, int end, int stride, float *row) {
+    const struct mandelbrot_row_ctx *c = (const struct mandelbrot_row_ctx*)ctx;
+    c->row(c->pos, c->size, c->width_px, c->height_px, c->depth, i, first, end, stride, row);
+}
+
+void compute_mandelbrot_chunk(const double pos[2], const double size[2], int width_px, int height_px, int depth, float *chunk) {
+    compute_mandelbrot_chunk_pass(pos, size, width_px, height_px, depth, 1, 0, NULL, chunk);
+}
+
+int compute_mandelbrot_chunk_pass(const double pos[2], const double size[2], int width_px, int height_px, int depth,
+        int stride, int refine, const struct mandelbrot_cancel *cancel, float *chunk) {
+    enum mandelbrot_precision precision = mandelbrot_select_precision(pos, size, width_px, height_px);
+    mandelbrot_row_fn row;
+    switch (precision) {
+    case PRECISION_FLOAT:         row = mandelbrot_kernels[mandelbrot_kernel_idx].row_float; break;
+    case PRECISION_DOUBLE:        row = mandelbrot_kernels[mandelbrot_kernel_idx].row_double; break;
+    case PRECISION_LONG_DOUBLE:   row = mandelbrot_row_long_double; break;
+#ifdef MANDELBROT_HAS_QUAD
+    case PRECISION_QUAD:          row = mandelbrot_row_quad; break;
+#endif
+    default:                      row = mandelbrot_row_double_double; break;
+    }
+    struct mandelbrot_row_ctx ctx = { row, pos, size, width_px, height_px, depth };
+    return mandelbrot_pass(mandelbrot_row_span, &ctx, width_px, height_px, stride, refine, cancel, chunk);
+}
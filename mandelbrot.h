@@ -0,0 +1,91 @@
+#ifndef MANDELBROT_H
+#define MANDELBROT_H
+
+#include <stdatomic.h>
+
+// Compute kernels. This module does not depend on OpenGL/GLFW, so the worker
+// threads (and any headless tooling) can use it without a GL context.
+
+#ifndef DEPTH
+#define DEPTH 1000 // default iteration limit; a build can set another one with -DDEPTH=n
+#endif
+
+#if defined(__SIZEOF_FLOAT128__) && !defined(MANDELBROT_NO_QUAD)
+#define MANDELBROT_HAS_QUAD
+#endif
+
+// Numeric types the kernels are instantiated for, cheapest first. A chunk is
+// computed in the cheapest type whose mantissa resolves its pixel step with
+// PRECISION_GUARD_BITS to spare (iteration amplifies rounding errors).
+enum mandelbrot_precision {
+    PRECISION_FLOAT,
+    PRECISION_DOUBLE,
+    PRECISION_LONG_DOUBLE,
+    PRECISION_DOUBLE_DOUBLE,
+    PRECISION_QUAD,
+    PRECISION_COUNT
+};
+#define PRECISION_GUARD_BITS 10
+
+// Escape values, one float per pixel: 0 for points in the set, otherwise
+// log2(1 + mu) / MANDELBROT_VALUE_OCTAVES for the smooth escape count mu, in
+// [MANDELBROT_VALUE_MIN, 1]. That spans escape counts up to 2^16 on a log
+// scale which fits a 16-bit texel to well below an iteration, and leaves the
+// colours to the palette.
+#define MANDELBROT_BAILOUT 256.0 // on |z^2|^2; large, so the smooth count is continuous
+#define MANDELBROT_VALUE_OCTAVES 16
+#define MANDELBROT_VALUE_MIN (1.0f / 65535) // smallest 16-bit value that is not inside
+#define MANDELBROT_DEPTH_MAX (1 << MANDELBROT_VALUE_OCTAVES) // deepest iteration limit the values resolve
+// Value of a point that escaped at iteration n with |z^2|^2 = mag
+float mandelbrot_escape_value(int n, double mag);
+// Smooth escape count mu of a value that is not inside
+double mandelbrot_escape_count(float value);
+
+// Fill `chunk` (width_px * height_px values, row-major, top row first) with
+// the escape values of the rectangle whose top-left corner is `pos`, at most
+// `depth` iterations per point. Points whose orbit settles on a cycle stop
+// early and are inside, so the interior costs far less than `depth`.
+void compute_mandelbrot_chunk(const double pos[2], const double size[2], int width_px, int height_px, int depth, float *chunk);
+// Progressive rendering. A pass computes the pixels on every `stride`-th row
+// and column and fills each stride x stride block with its top-left sample,
+// so the chunk can be shown right away. With `refine` set, the samples of
+// the pass at 2 * stride are in `chunk` already and are not computed again:
+// passes at MANDELBROT_PASS_STRIDE, ..., 4, 2, 1 cost one full pass and end
+// with exactly its result.
+#define MANDELBROT_PASS_STRIDE 8
+// Cancellation token: a pass gives up as soon as *generation no longer
+// equals `expected`, so work for an abandoned view stops within a row
+struct mandelbrot_cancel {
+    const atomic_uint *generation;
+    unsigned expected;
+};
+// Returns 0, or -1 when cancelled (`chunk` is then incomplete). `cancel`
+// may be NULL
+int compute_mandelbrot_chunk_pass(const double pos[2], const double size[2], int width_px, int height_px, int depth,
+        int stride, int refine, const struct mandelbrot_cancel *cancel, float *chunk);
+
+// Computes pixels first, first + stride, ... (below `end`) of row i of a chunk
+typedef void (*mandelbrot_span_fn)(const void *ctx, int i, int first, int end, int stride, float *row);
+// Drives one pass of any kernel: calls `span` for the pixels the pass needs,
+// then fills the blocks. With MANDELBROT_SUBDIVIDE=1 in the environment,
+// rectangles whose whole border is inside the set are filled without
+// iterating (Mariani-Silver), which is faster but not exact.
+// Returns 0, or -1 when cancelled.
+int mandelbrot_pass(mandelbrot_span_fn span, const void *ctx, int width_px, int height_px, int stride, int refine,
+        const struct mandelbrot_cancel *cancel, float *chunk);
+float compute_mandelbrot(long double x, long double y, int depth);
+float compute_mandelbrot_double(double x, double y, int depth);
+
+// Name of the row kernel picked for this CPU ("avx512", "avx2", "sse2" or
+// "scalar"). Can be forced with the MANDELBROT_KERNEL environment variable.
+const char *mandelbrot_kernel_name(void);
+
+// Cheapest precision for a chunk. MANDELBROT_PRECISION=<name> in the
+// environment forces one ("float", "double", "long double", ...)
+enum mandelbrot_precision mandelbrot_select_precision(const double pos[2], const double size[2], int width_px, int height_px);
+// 1 when MANDELBROT_PRECISION forces the precision
+int mandelbrot_precision_forced(void);
+// NULL if the type is not available on this platform
+const char *mandelbrot_precision_name(enum mandelbrot_precision precision);
+
+#endif
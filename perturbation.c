@@ -0,0 +1,273 @@
+#include "perturbation.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PERTURBATION_X86
+#endif
+
+#define PERTURBATION_BAILOUT 16.0 // on |z|^2, the square root of MANDELBROT_BAILOUT
+
+struct reference_orbit *reference_orbit_create(const struct bignum c[2], int limbs, int depth) {
+    struct reference_orbit *ref = (struct reference_orbit*)malloc(sizeof(*ref));
+    atomic_init(&ref->refcount, 1);
+    ref->c[0] = c[0];
+    ref->c[1] = c[1];
+    ref->limbs = limbs;
+    ref->depth = depth;
+    ref->z = (double*)malloc(2 * depth * sizeof(ref->z[0]));
+    struct bignum z, zi, zz, zizi, tmp;
+    bignum_from_double(&z, 0.0);
+    bignum_from_double(&zi, 0.0);
+    ref->z[0] = 0.0;
+    ref->z[1] = 0.0;
+    int n = 1;
+    for (; n < depth; n++) {
+        // z_{n+1} = z_n^2 + c, with z_n^2 = (z^2 - zi^2) + i (2 z zi)
+        bignum_mul(&zz, &z, &z, limbs);
+        bignum_mul(&zizi, &zi, &zi, limbs);
+        bignum_mul(&tmp, &z, &zi, limbs);
+        bignum_add(&zi, &tmp, &tmp, limbs);
+        bignum_add(&zi, &zi, &c[1], limbs);
+        bignum_sub(&z, &zz, &zizi, limbs);
+        bignum_add(&z, &z, &c[0], limbs);
+        double re = bignum_to_double(&z, limbs);
+        double im = bignum_to_double(&zi, limbs);
+        ref->z[2 * n + 0] = re;
+        ref->z[2 * n + 1] = im;
+        // Pixels rebase once they pass the end, no point going further
+        if (re * re + im * im > 4.0) {
+            n++;
+            break;
+        }
+    }
+    ref->length = n;
+    ref->series_skip = 0;
+    ref->series_radius = 0.0;
+    return ref;
+}
+
+int reference_orbit_approximate(struct reference_orbit *ref, double radius, double step) {
+    ref->series_skip = 0;
+    ref->series_radius = radius;
+    const char *enabled = getenv("MANDELBROT_SERIES");
+    if ((enabled && strcmp(enabled, "0") == 0) || radius <= 0.0) {
+        return 0;
+    }
+    // b_k = a_k * radius^k, complex, re/im interleaved
+    double b[2 * SERIES_TERMS] = { 0 };
+    double next[2 * SERIES_TERMS];
+    double tolerance = SERIES_TOLERANCE * step / radius;
+    // Keep clear of the end of the orbit, pixels need it to rebase
+    for (int n = 0; n < ref->length - 2; n++) {
+        double Zx = ref->z[2 * n + 0];
+        double Zy = ref->z[2 * n + 1];
+        for (int k = 0; k < SERIES_TERMS; k++) {
+            double re = 2 * (Zx * b[2 * k + 0] - Zy * b[2 * k + 1]);
+            double im = 2 * (Zx * b[2 * k + 1] + Zy * b[2 * k + 0]);
+            // sum over i + j = k (0 based: i + j = k - 1)
+            for (int i = 0; i < k; i++) {
+                int j = k - 1 - i;
+                re += b[2 * i + 0] * b[2 * j + 0] - b[2 * i + 1] * b[2 * j + 1];
+                im += b[2 * i + 0] * b[2 * j + 1] + b[2 * i + 1] * b[2 * j + 0];
+            }
+            next[2 * k + 0] = re;
+            next[2 * k + 1] = im;
+        }
+        next[0] += radius;
+        // Stop before the truncated terms become visible
+        double first = hypot(next[0], next[1]);
+        double last = hypot(next[2 * SERIES_TERMS - 2], next[2 * SERIES_TERMS - 1]);
+        if (!(last <= tolerance * first)) {
+            break;
+        }
+        memcpy(b, next, sizeof(b));
+        ref->series_skip = n + 1;
+    }
+    memcpy(ref->series, b, sizeof(b));
+    return ref->series_skip;
+}
+
+// d_N for a pixel at dc, by Horner's scheme in u = dc / radius
+static void series_evaluate(const struct reference_orbit *ref, double dcx, double dcy, double *dx, double *dy) {
+    double ux = dcx / ref->series_radius;
+    double uy = dcy / ref->series_radius;
+    double re = 0.0;
+    double im = 0.0;
+    for (int k = SERIES_TERMS - 1; k >= 0; k--) {
+        double tr = re + ref->series[2 * k + 0];
+        double ti = im + ref->series[2 * k + 1];
+        re = tr * ux - ti * uy;
+        im = tr * uy + ti * ux;
+    }
+    *dx = re;
+    *dy = im;
+}
+
+void reference_orbit_retain(struct reference_orbit *ref) {
+    atomic_fetch_add(&ref->refcount, 1);
+}
+
+void reference_orbit_release(struct reference_orbit *ref) {
+    if (atomic_fetch_sub(&ref->refcount, 1) == 1) {
+        free(ref->z);
+        free(ref);
+    }
+}
+
+
+int perturbation_needed(const double pos[2], const double size[2], int width_px, int height_px) {
+    if (mandelbrot_precision_forced()) {
+        return 0;
+    }
+    return mandelbrot_select_precision(pos, size, width_px, height_px) >= PERTURBATION_MIN_PRECISION;
+}
+
+// Escape test matches the direct kernels: they bail out on
+// |z^2|^2 >= MANDELBROT_BAILOUT, which is |z|^2 >= PERTURBATION_BAILOUT
+static float compute_mandelbrot_perturbed(const struct reference_orbit *ref, double dcx, double dcy) {
+    const double *Z = ref->z;
+    double dx = 0.0;
+    double dy = 0.0;
+    int m = ref->series_skip;
+    if (m > 0) {
+        series_evaluate(ref, dcx, dcy, &dx, &dy);
+    }
+    for (int i = 1 + m; i < ref->depth; i++) {
+        double zx = Z[2 * m + 0] + dx;
+        double zy = Z[2 * m + 1] + dy;
+        double mag = zx * zx + zy * zy;
+        if (mag >= PERTURBATION_BAILOUT) {
+            return mandelbrot_escape_value(i, mag * mag);
+        }
+        if (mag < dx * dx + dy * dy || m == ref->length - 1) {
+            dx = zx;
+            dy = zy;
+            m = 0;
+        }
+        double Zx = Z[2 * m + 0];
+        double Zy = Z[2 * m + 1];
+        double nx = 2 * (Zx * dx - Zy * dy) + (dx * dx - dy * dy) + dcx;
+        double ny = 2 * (Zx * dy + Zy * dx) + 2 * dx * dy + dcy;
+        dx = nx;
+        dy = ny;
+        m++;
+    }
+    return 0.0f;
+}
+
+#ifdef PERTURBATION_X86
+// Four pixels at a time. Every lane follows the reference orbit at its own
+// index m, so Z is gathered. Same operations, in the same order, as the
+// scalar version.
+__attribute__((target("avx2")))
+static void mandelbrot_row_perturbed_avx2(const struct reference_orbit *ref, double dcx0, double step_x, double dcy,
+        int first, int end, int stride, float *row) {
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d bailout = _mm256_set1_pd(PERTURBATION_BAILOUT);
+    const __m256i last = _mm256_set1_epi64x(ref->length - 1);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256d cy = _mm256_set1_pd(dcy);
+    for (int j = first; j < end; j += 4 * stride) {
+        __m256d lane = _mm256_set_pd(j + 3 * stride + 0.5, j + 2 * stride + 0.5, j + stride + 0.5, j + 0.5);
+        __m256d cx = _mm256_add_pd(_mm256_set1_pd(dcx0), _mm256_mul_pd(lane, _mm256_set1_pd(step_x)));
+        __m256d dx = _mm256_setzero_pd();
+        __m256d dy = _mm256_setzero_pd();
+        if (ref->series_skip > 0) {
+            double lane_cx[4], lane_dx[4], lane_dy[4];
+            _mm256_storeu_pd(lane_cx, cx);
+            for (int k = 0; k < 4; k++) {
+                series_evaluate(ref, lane_cx[k], dcy, &lane_dx[k], &lane_dy[k]);
+            }
+            dx = _mm256_loadu_pd(lane_dx);
+            dy = _mm256_loadu_pd(lane_dy);
+        }
+        __m256i m = _mm256_set1_epi64x(ref->series_skip);
+        __m256d escaped = _mm256_setzero_pd();
+        __m256d escape_mag = _mm256_setzero_pd();
+        __m256i count = _mm256_setzero_si256(); // iterations a lane stayed bounded
+        for (int i = 1 + ref->series_skip; i < ref->depth; i++) {
+            __m256i idx = _mm256_add_epi64(m, m);
+            __m256d Zx = _mm256_i64gather_pd(ref->z, idx, 8);
+            __m256d Zy = _mm256_i64gather_pd(ref->z + 1, idx, 8);
+            __m256d zx = _mm256_add_pd(Zx, dx);
+            __m256d zy = _mm256_add_pd(Zy, dy);
+            __m256d mag = _mm256_add_pd(_mm256_mul_pd(zx, zx), _mm256_mul_pd(zy, zy));
+            // |z|^2 of the escaping iteration, for the smooth count
+            escape_mag = _mm256_blendv_pd(mag, escape_mag, escaped);
+            escaped = _mm256_or_pd(escaped, _mm256_cmp_pd(mag, bailout, _CMP_GE_OQ));
+            if (_mm256_movemask_pd(escaped) == 0xf) {
+                break;
+            }
+            count = _mm256_add_epi64(count, _mm256_andnot_si256(_mm256_castpd_si256(escaped), one));
+            __m256d dmag = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            __m256d rebase = _mm256_or_pd(_mm256_cmp_pd(mag, dmag, _CMP_LT_OQ),
+                    _mm256_castsi256_pd(_mm256_cmpeq_epi64(m, last)));
+            dx = _mm256_blendv_pd(dx, zx, rebase);
+            dy = _mm256_blendv_pd(dy, zy, rebase);
+            Zx = _mm256_andnot_pd(rebase, Zx); // Z_0 = 0
+            Zy = _mm256_andnot_pd(rebase, Zy);
+            m = _mm256_andnot_si256(_mm256_castpd_si256(rebase), m);
+            __m256d nx = _mm256_add_pd(_mm256_add_pd(
+                        _mm256_mul_pd(two, _mm256_sub_pd(_mm256_mul_pd(Zx, dx), _mm256_mul_pd(Zy, dy))),
+                        _mm256_sub_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy))), cx);
+            __m256d ny = _mm256_add_pd(_mm256_add_pd(
+                        _mm256_mul_pd(two, _mm256_add_pd(_mm256_mul_pd(Zx, dy), _mm256_mul_pd(Zy, dx))),
+                        _mm256_mul_pd(_mm256_mul_pd(two, dx), dy)), cy);
+            dx = nx;
+            dy = ny;
+            m = _mm256_add_epi64(m, one);
+        }
+        int mask = _mm256_movemask_pd(escaped);
+        long long lane_count[4];
+        double lane_mag[4];
+        _mm256_storeu_si256((__m256i*)lane_count, count);
+        _mm256_storeu_pd(lane_mag, escape_mag);
+        for (int k = 0; k < 4 && j + k * stride < end; k++) {
+            row[j + k * stride] = (mask >> k) & 1 ?
+                mandelbrot_escape_value(1 + ref->series_skip + (int)lane_count[k], lane_mag[k] * lane_mag[k]) : 0.0f;
+        }
+    }
+}
+#endif
+
+struct perturbed_row_ctx {
+    const struct reference_orbit *ref;
+    const double *offset;
+    const double *size;
+    int width_px;
+    int height_px;
+};
+
+// Pixels first, first + stride, ... of row i
+static void mandelbrot_row_perturbed(const void *ctx, int i, int first, int end, int stride, float *row) {
+    const struct perturbed_row_ctx *c = (const struct perturbed_row_ctx*)ctx;
+    double step_x = c->size[0] / c->width_px;
+    double step_y = - c->size[1] / c->height_px; // reverse Y axis
+    double dcy = c->offset[1] + (i + 0.5) * step_y;
+#ifdef PERTURBATION_X86
+    // Follow the kernel choice of the direct path (and its MANDELBROT_KERNEL override)
+    const char *kernel = mandelbrot_kernel_name();
+    if (strcmp(kernel, "avx2") == 0 || strcmp(kernel, "avx512") == 0) {
+        mandelbrot_row_perturbed_avx2(c->ref, c->offset[0], step_x, dcy, first, end, stride, row);
+        return;
+    }
+#endif
+    for (int j = first; j < end; j += stride) {
+        double dcx = c->offset[0] + (j + 0.5) * step_x; // 0.5 to center the integration
+        row[j] = compute_mandelbrot_perturbed(c->ref, dcx, dcy);
+    }
+}
+
+void compute_mandelbrot_chunk_perturbed(const struct reference_orbit *ref, const double offset[2], const double size[2], int width_px, int height_px, float *chunk) {
+    compute_mandelbrot_chunk_perturbed_pass(ref, offset, size, width_px, height_px, 1, 0, NULL, chunk);
+}
+
+int compute_mandelbrot_chunk_perturbed_pass(const struct reference_orbit *ref, const double offset[2], const double size[2], int width_px, int height_px,
+        int stride, int refine, const struct mandelbrot_cancel *cancel, float *chunk) {
+    struct perturbed_row_ctx ctx = { ref, offset, size, width_px, height_px };
+    return mandelbrot_pass(mandelbrot_row_perturbed, &ctx, width_px, height_px, stride, refine, cancel, chunk);
+}
@@ -0,0 +1,71 @@
+#ifndef PERTURBATION_H
+#define PERTURBATION_H
+
+#include <stdatomic.h>
+
+#include "bignum.h"
+#include "mandelbrot.h"
+
+// Deep zoom by perturbation.
+// One reference orbit Z_n of the view origin C is iterated in bignum
+// precision and stored as doubles. A pixel at C + dc then only iterates its
+// (tiny) difference to the reference in double:
+//     d_{n+1} = 2 Z_n d_n + d_n^2 + dc
+// When |Z_m + d| drops below |d| the reference no longer describes the pixel
+// (a "glitch"); the pixel is rebased onto the start of the reference orbit,
+// d = Z_m + d, m = 0, which also covers running past the end of the orbit.
+// This works as long as dc fits a double, i.e. down to widths of ~1e-290.
+
+// Chunks that would need at least this precision are perturbed instead,
+// unless MANDELBROT_PRECISION forces a type: then that kernel computes them
+#define PERTURBATION_MIN_PRECISION PRECISION_LONG_DOUBLE
+
+// Series approximation.
+// Early on, d_n is a smooth function of dc and can be written as a
+// polynomial  d_n = sum_k a_k dc^k  whose coefficients follow from Z_n:
+//     a_1' = 2 Z_n a_1 + 1,   a_k' = 2 Z_n a_k + sum_{i+j=k} a_i a_j
+// Every pixel of the view then starts at iteration N with d_N from the
+// polynomial instead of iterating from 0. N is the last iteration where the
+// highest term stays below SERIES_TOLERANCE of a pixel step (the first term
+// maps pixel steps in dc to steps in d_N). Coefficients are stored scaled by
+// radius^k, so deep zooms do not underflow.
+#define SERIES_TERMS 8
+#define SERIES_TOLERANCE 1e-3
+
+// Shared (reference counted) by all chunk jobs of a view
+struct reference_orbit {
+    atomic_int refcount;
+    struct bignum c[2];    // reference point, the view origin
+    int limbs;
+    int depth;             // iteration limit of the pixels perturbed from it
+    int length;            // number of stored Z_n, Z_0 = 0, at most depth
+    double *z;             // 2 * length values: re, im
+    // Series approximation, series_skip == 0 when disabled
+    int series_skip;       // N, iterations every pixel skips
+    double series_radius;  // largest |dc| the series is valid for
+    double series[2 * SERIES_TERMS]; // a_k * radius^k at iteration N
+};
+
+// Iterates the reference for up to `depth` iterations, which is then also
+// the limit of every pixel computed against it
+struct reference_orbit *reference_orbit_create(const struct bignum c[2], int limbs, int depth);
+void reference_orbit_retain(struct reference_orbit *ref);
+void reference_orbit_release(struct reference_orbit *ref);
+// Fit the series for pixels up to `radius` away from the reference, with
+// pixel size `step`. MANDELBROT_SERIES=0 in the environment disables it, to
+// compare against plain perturbation: the two agree up to rounding, which
+// moves a few escape counts by one, and a few pixels that escape right at the
+// limit across it. Returns the number of skipped iterations.
+int reference_orbit_approximate(struct reference_orbit *ref, double radius, double step);
+
+// Does a chunk of this size need the perturbation path
+int perturbation_needed(const double pos[2], const double size[2], int width_px, int height_px);
+
+// Same layout as compute_mandelbrot_chunk, but `offset` is relative to the
+// reference point of `ref`
+void compute_mandelbrot_chunk_perturbed(const struct reference_orbit *ref, const double offset[2], const double size[2], int width_px, int height_px, float *chunk);
+// Progressive pass, see compute_mandelbrot_chunk_pass
+int compute_mandelbrot_chunk_perturbed_pass(const struct reference_orbit *ref, const double offset[2], const double size[2], int width_px, int height_px,
+        int stride, int refine, const struct mandelbrot_cancel *cancel, float *chunk);
+
+#endif
@@ -0,0 +1,450 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include "mandelbrot.h"
+#include "perturbation.h"
+#include "remote.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define HEAP_INITIAL_CAPACITY 64
+
+// Mutex protected binary min-heap on the job priority. The owner takes its
+// most urgent job, unless another worker holds a more urgent one, which it
+// steals; submissions are spread round-robin, so every heap holds a share
+// of each priority.
+struct job_heap {
+    pthread_mutex_t lock;
+    struct chunk_job **items;
+    int capacity;
+    int count;
+};
+
+struct worker {
+    struct chunk_pool *pool;
+    struct job_heap heap;
+    pthread_t thread;
+    int id;
+    struct remote_worker *remote; // process the jobs go to, NULL to compute them here
+};
+
+struct chunk_pool {
+    struct worker *workers;
+    int thread_count;
+    atomic_uint next_worker;  // round-robin submit target
+    atomic_uint generation;
+    atomic_int outstanding;   // submitted, not yet polled or dropped
+    // Sleeping workers
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    int queued;               // jobs sitting in the heaps
+    int quit;
+    // Finished jobs, FIFO
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+    struct chunk_job *done_head;
+    struct chunk_job *done_tail;
+};
+
+
+static void heap_init(struct job_heap *heap) {
+    pthread_mutex_init(&heap->lock, NULL);
+    heap->capacity = HEAP_INITIAL_CAPACITY;
+    heap->items = (struct chunk_job**)malloc(heap->capacity * sizeof(heap->items[0]));
+    heap->count = 0;
+}
+
+static void heap_free(struct job_heap *heap) {
+    for (int i = 0; i < heap->count; i++) {
+        chunk_job_free(heap->items[i]);
+    }
+    free(heap->items);
+    pthread_mutex_destroy(&heap->lock);
+}
+
+// Lock held for these
+static void heap_sift_up(struct job_heap *heap, int i) {
+    struct chunk_job *job = heap->items[i];
+    while (i > 0 && job->priority < heap->items[(i - 1) / 2]->priority) {
+        heap->items[i] = heap->items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->items[i] = job;
+}
+
+static void heap_sift_down(struct job_heap *heap, int i) {
+    struct chunk_job *job = heap->items[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && heap->items[child + 1]->priority < heap->items[child]->priority) {
+            child++;
+        }
+        if (!(heap->items[child]->priority < job->priority)) {
+            break;
+        }
+        heap->items[i] = heap->items[child];
+        i = child;
+    }
+    heap->items[i] = job;
+}
+
+static void heap_push(struct job_heap *heap, struct chunk_job *job) {
+    pthread_mutex_lock(&heap->lock);
+    if (heap->count == heap->capacity) {
+        heap->capacity *= 2;
+        heap->items = (struct chunk_job**)realloc(heap->items, heap->capacity * sizeof(heap->items[0]));
+    }
+    heap->items[heap->count++] = job;
+    heap_sift_up(heap, heap->count - 1);
+    pthread_mutex_unlock(&heap->lock);
+}
+
+static struct chunk_job *heap_pop(struct job_heap *heap) {
+    struct chunk_job *job = NULL;
+    pthread_mutex_lock(&heap->lock);
+    if (heap->count > 0) {
+        job = heap->items[0];
+        heap->items[0] = heap->items[--heap->count];
+        if (heap->count > 0) {
+            heap_sift_down(heap, 0);
+        }
+    }
+    pthread_mutex_unlock(&heap->lock);
+    return job;
+}
+
+// Priority of the most urgent job, INFINITY if there is none. With
+// try_only a busy victim counts as empty (its owner is at it), and sets *busy
+static double heap_peek(struct job_heap *heap, int try_only, int *busy) {
+    double priority = INFINITY;
+    if (try_only ? pthread_mutex_trylock(&heap->lock) != 0 : pthread_mutex_lock(&heap->lock) != 0) {
+        *busy = 1;
+        return priority;
+    }
+    if (heap->count > 0) {
+        priority = heap->items[0]->priority;
+    }
+    pthread_mutex_unlock(&heap->lock);
+    return priority;
+}
+
+
+// Tries the victims without waiting for their locks first. Only when that
+// finds nothing while a victim was busy does it wait for them: its queued
+// jobs keep the worker out of the idle wait, so giving up would spin
+static struct chunk_job *worker_find_job(struct worker *self) {
+    struct chunk_pool *pool = self->pool;
+    struct chunk_job *job = NULL;
+    int busy = 1;
+    for (int try_only = 1; !job && busy && try_only >= 0; try_only--) {
+        busy = 0;
+        struct job_heap *best = &self->heap;
+        double best_priority = heap_peek(best, 0, &busy);
+        for (int i = 1; i < pool->thread_count; i++) {
+            struct job_heap *victim = &pool->workers[(self->id + i) % pool->thread_count].heap;
+            double priority = heap_peek(victim, try_only, &busy);
+            if (priority < best_priority) {
+                best = victim;
+                best_priority = priority;
+            }
+        }
+        // The victim may have been emptied in between
+        job = heap_pop(best);
+        if (!job && best != &self->heap) {
+            job = heap_pop(&self->heap);
+        }
+    }
+    if (job) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return job;
+}
+
+// Back in the queue after its process failed, for whichever worker is free
+static void worker_requeue(struct worker *self, struct chunk_job *job) {
+    struct chunk_pool *pool = self->pool;
+    heap_push(&self->heap, job);
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+// The job goes to the worker's process. A process that fails is restarted
+// and the job queued again; one that can not be restarted is given up on,
+// the worker computes its jobs itself from then on
+static int worker_compute_remote(struct worker *self, struct chunk_job *job) {
+    if (remote_worker_compute(self->remote, job) == 0) {
+        return 0;
+    }
+    job->attempts++;
+    fprintf(stderr, "[POOL] worker process '%s' failed, restarting it\n", remote_worker_command(self->remote));
+    if (remote_worker_restart(self->remote) != 0) {
+        fprintf(stderr, "[POOL] worker process '%s' can not be restarted, computing here\n", remote_worker_command(self->remote));
+        remote_worker_stop(self->remote);
+        self->remote = NULL;
+    }
+    worker_requeue(self, job);
+    return -1;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *self = (struct worker*)arg;
+    struct chunk_pool *pool = self->pool;
+    for (;;) {
+        struct chunk_job *job = worker_find_job(self);
+        if (!job) {
+            pthread_mutex_lock(&pool->idle_lock);
+            while (pool->queued <= 0 && !pool->quit) {
+                pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+            }
+            int quit = pool->quit;
+            pthread_mutex_unlock(&pool->idle_lock);
+            if (quit) {
+                break;
+            }
+            continue;
+        }
+        if (job->generation != atomic_load(&pool->generation)) {
+            // The view has changed since the job was issued
+            chunk_job_free(job);
+            atomic_fetch_sub(&pool->outstanding, 1);
+            continue;
+        }
+        int status;
+        if (self->remote && job->attempts < POOL_REMOTE_ATTEMPTS) {
+            if (worker_compute_remote(self, job) != 0) {
+                continue;
+            }
+            // Not computed partway, but dropped all the same
+            status = job->generation == atomic_load(&pool->generation) ? 0 : -1;
+        } else {
+            // ... or changes while it is being computed
+            struct mandelbrot_cancel cancel = { &pool->generation, job->generation };
+            if (job->reference) {
+                status = compute_mandelbrot_chunk_perturbed_pass(job->reference, job->pos, job->size, job->width_px, job->height_px,
+                        job->stride, job->refine, &cancel, job->pixels);
+            } else {
+                status = compute_mandelbrot_chunk_pass(job->pos, job->size, job->width_px, job->height_px, job->depth,
+                        job->stride, job->refine, &cancel, job->pixels);
+            }
+        }
+        if (status != 0) {
+            chunk_job_free(job);
+            atomic_fetch_sub(&pool->outstanding, 1);
+            continue;
+        }
+        job->next = NULL;
+        pthread_mutex_lock(&pool->done_lock);
+        if (pool->done_tail) {
+            pool->done_tail->next = job;
+        } else {
+            pool->done_head = job;
+        }
+        pool->done_tail = job;
+        pthread_cond_signal(&pool->done_cond);
+        pthread_mutex_unlock(&pool->done_lock);
+    }
+    return NULL;
+}
+
+
+static struct chunk_pool *chunk_pool_start(int thread_count, struct remote_worker **remotes) {
+    struct chunk_pool *pool = (struct chunk_pool*)calloc(1, sizeof(*pool));
+    pool->thread_count = thread_count;
+    pool->workers = (struct worker*)calloc(thread_count, sizeof(pool->workers[0]));
+    atomic_init(&pool->next_worker, 0);
+    atomic_init(&pool->generation, 1);
+    atomic_init(&pool->outstanding, 0);
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    pthread_mutex_init(&pool->done_lock, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (int i = 0; i < thread_count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pool->workers[i].remote = remotes ? remotes[i] : NULL;
+        heap_init(&pool->workers[i].heap);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+            fprintf(stderr, "[POOL] failed to spawn worker %d!\n", i);
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+struct chunk_pool *chunk_pool_create(int thread_count) {
+    if (thread_count <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cores > 0 ? (int)cores : 1;
+    }
+    return chunk_pool_start(thread_count, NULL);
+}
+
+struct chunk_pool *chunk_pool_create_remote(struct remote_worker **remotes, int count) {
+    return chunk_pool_start(count, remotes);
+}
+
+void chunk_pool_destroy(struct chunk_pool *pool) {
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+    // Workers finish the job they are busy with; the rest is freed unseen
+    atomic_fetch_add(&pool->generation, 1);
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        heap_free(&pool->workers[i].heap);
+        if (pool->workers[i].remote) {
+            remote_worker_stop(pool->workers[i].remote);
+        }
+    }
+    struct chunk_job *job;
+    while ((job = chunk_pool_poll(pool))) {
+        chunk_job_free(job);
+    }
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_mutex_destroy(&pool->done_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    pthread_mutex_destroy(&pool->idle_lock);
+    free(pool->workers);
+    free(pool);
+}
+
+int chunk_pool_thread_count(const struct chunk_pool *pool) {
+    return pool->thread_count;
+}
+
+
+struct chunk_job *chunk_job_create(const double pos[2], const double size[2], int width_px, int height_px, const struct tile_key *key, unsigned generation,
+        struct reference_orbit *reference) {
+    struct chunk_job *job = (struct chunk_job*)malloc(sizeof(*job) + width_px * height_px * sizeof(float));
+    job->pos[0] = pos[0];
+    job->pos[1] = pos[1];
+    job->size[0] = size[0];
+    job->size[1] = size[1];
+    job->width_px = width_px;
+    job->height_px = height_px;
+    job->key = *key;
+    job->depth = reference ? reference->depth : DEPTH;
+    job->stride = 1;
+    job->refine = 0;
+    job->priority = 0.0;
+    job->attempts = 0;
+    job->generation = generation;
+    job->pixels = (float*)(job + 1);
+    job->reference = reference;
+    if (reference) {
+        reference_orbit_retain(reference);
+    }
+    job->next = NULL;
+    return job;
+}
+
+void chunk_job_free(struct chunk_job *job) {
+    if (job->reference) {
+        reference_orbit_release(job->reference);
+    }
+    free(job);
+}
+
+
+void chunk_pool_submit(struct chunk_pool *pool, struct chunk_job *job) {
+    unsigned target = atomic_fetch_add(&pool->next_worker, 1) % pool->thread_count;
+    atomic_fetch_add(&pool->outstanding, 1);
+    heap_push(&pool->workers[target].heap, job);
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+// Takes the oldest finished job, done_lock held
+static struct chunk_job *chunk_pool_take(struct chunk_pool *pool) {
+    struct chunk_job *job = pool->done_head;
+    if (job) {
+        pool->done_head = job->next;
+        if (!pool->done_head) {
+            pool->done_tail = NULL;
+        }
+        job->next = NULL;
+        atomic_fetch_sub(&pool->outstanding, 1);
+    }
+    return job;
+}
+
+struct chunk_job *chunk_pool_poll(struct chunk_pool *pool) {
+    pthread_mutex_lock(&pool->done_lock);
+    struct chunk_job *job = chunk_pool_take(pool);
+    pthread_mutex_unlock(&pool->done_lock);
+    return job;
+}
+
+struct chunk_job *chunk_pool_wait(struct chunk_pool *pool) {
+    pthread_mutex_lock(&pool->done_lock);
+    while (!pool->done_head) {
+        pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+    }
+    struct chunk_job *job = chunk_pool_take(pool);
+    pthread_mutex_unlock(&pool->done_lock);
+    return job;
+}
+
+int chunk_pool_reprioritize(struct chunk_pool *pool, double (*priority)(const struct chunk_job *job, void *ctx), void *ctx) {
+    unsigned generation = atomic_load(&pool->generation);
+    int dropped = 0;
+    for (int w = 0; w < pool->thread_count; w++) {
+        struct job_heap *heap = &pool->workers[w].heap;
+        pthread_mutex_lock(&heap->lock);
+        int kept = 0;
+        for (int i = 0; i < heap->count; i++) {
+            struct chunk_job *job = heap->items[i];
+            // Stale jobs go too, the callback is spared them
+            double p = job->generation == generation ? priority(job, ctx) : -1.0;
+            if (p < 0.0) {
+                chunk_job_free(job);
+                dropped++;
+                continue;
+            }
+            job->priority = p;
+            heap->items[kept++] = job;
+        }
+        heap->count = kept;
+        for (int i = kept / 2 - 1; i >= 0; i--) {
+            heap_sift_down(heap, i);
+        }
+        pthread_mutex_unlock(&heap->lock);
+    }
+    if (dropped) {
+        atomic_fetch_sub(&pool->outstanding, dropped);
+        pthread_mutex_lock(&pool->idle_lock);
+        pool->queued -= dropped;
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return dropped;
+}
+
+unsigned chunk_pool_cancel(struct chunk_pool *pool) {
+    return atomic_fetch_add(&pool->generation, 1) + 1;
+}
+
+unsigned chunk_pool_generation(struct chunk_pool *pool) {
+    return atomic_load(&pool->generation);
+}
+
+int chunk_pool_pending(struct chunk_pool *pool) {
+    return atomic_load(&pool->outstanding);
+}
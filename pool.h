@@ -0,0 +1,78 @@
+#ifndef POOL_H
+#define POOL_H
+
+// Background chunk compute pool.
+// One worker thread per core, each with its own priority heap of chunk jobs.
+// A worker takes the most urgent job of its own heap, or steals the most
+// urgent job of another worker's heap when that one is more urgent (lower
+// priority value) or its own heap is empty. Submissions go round-robin, so
+// the order is global up to what is being computed. Finished jobs are handed back
+// through a completion queue, which the GL thread drains once per frame.
+// The GL thread never waits for compute: it only uploads what is ready.
+
+#include "tilecache.h"
+
+struct reference_orbit;
+struct remote_worker;
+
+#define POOL_REMOTE_ATTEMPTS 3 // worker processes failing a job before it is computed locally
+
+struct chunk_job {
+    double pos[2];
+    double size[2];
+    int width_px;
+    int height_px;
+    struct tile_key key;    // cache tile the job computes
+    int depth;              // iteration limit
+    int stride;             // progressive pass, see compute_mandelbrot_chunk_pass
+    int refine;             // pixels hold the pass at 2 * stride
+    double priority;        // lower runs first, 0 unless changed
+    int attempts;           // worker processes that failed it
+    unsigned generation;    // view generation the job was issued for
+    float *pixels;          // width_px * height_px values, owned by the job
+    struct reference_orbit *reference; // if set, pos is relative to it
+    struct chunk_job *next; // completion queue link
+};
+
+struct chunk_pool;
+
+// thread_count <= 0 spawns one worker per online core
+struct chunk_pool *chunk_pool_create(int thread_count);
+void chunk_pool_destroy(struct chunk_pool *pool);
+// One thread per worker process, which hands it the jobs (see remote.h).
+// The pool owns the workers from then on. A job is tried on up to
+// POOL_REMOTE_ATTEMPTS processes, restarting each one that fails, then
+// computed by the thread itself
+struct chunk_pool *chunk_pool_create_remote(struct remote_worker **remotes, int count);
+int chunk_pool_thread_count(const struct chunk_pool *pool);
+
+// Job memory (including the pixel buffer) is a single allocation. A non-NULL
+// reference orbit selects the perturbation path, the job holds a reference.
+// Jobs compute a single full resolution pass unless stride is changed, at
+// DEPTH iterations unless depth is changed (a perturbed job iterates as deep
+// as its reference orbit, that is where its depth comes from); a polled job
+// can be submitted again for its next pass.
+struct chunk_job *chunk_job_create(const double pos[2], const double size[2], int width_px, int height_px, const struct tile_key *key, unsigned generation,
+        struct reference_orbit *reference);
+void chunk_job_free(struct chunk_job *job);
+
+void chunk_pool_submit(struct chunk_pool *pool, struct chunk_job *job);
+// Returns a finished job or NULL, never blocks. The caller owns the job.
+struct chunk_job *chunk_pool_poll(struct chunk_pool *pool);
+// Blocks until a job is finished, for callers without a frame loop. Only
+// jobs of the current generation finish: the caller has to know one is due.
+struct chunk_job *chunk_pool_wait(struct chunk_pool *pool);
+// Invalidate all queued work, returns the new generation. Jobs of older
+// generations are dropped by the workers without being computed, or stop
+// computing partway through a pass.
+unsigned chunk_pool_cancel(struct chunk_pool *pool);
+unsigned chunk_pool_generation(struct chunk_pool *pool);
+// Sets the priority of every queued job of the current generation to
+// priority(job, ctx), and drops the jobs it gives a negative one. Returns the
+// number of jobs dropped, which never come back from poll. The callback runs
+// on the calling thread with queue locks held: it must not call the pool.
+int chunk_pool_reprioritize(struct chunk_pool *pool, double (*priority)(const struct chunk_job *job, void *ctx), void *ctx);
+// Number of jobs submitted but not yet polled
+int chunk_pool_pending(struct chunk_pool *pool);
+
+#endif
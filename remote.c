@@ -0,0 +1,334 @@
+#define _POSIX_C_SOURCE 200809L
+#include "remote.h"
+#include "pool.h"
+#include "perturbation.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define REMOTE_MAX_PIXELS (1 << 26) // per tile, larger ones are garbage
+
+struct remote_header {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t length;        // bytes after the header
+};
+
+// Followed by 2 * length orbit values
+struct remote_reference {
+    int32_t depth;
+    int32_t length;
+    int32_t series_skip;
+    int32_t reserved;
+    double series_radius;
+    double series[2 * SERIES_TERMS];
+};
+
+// Followed by the pixels of the previous pass when refining
+struct remote_tile {
+    double pos[2];
+    double size[2];
+    int32_t width_px;
+    int32_t height_px;
+    int32_t depth;
+    int32_t stride;
+    int32_t refine;
+    int32_t perturbed;      // pos is relative to the last reference
+};
+
+struct remote_worker {
+    char *command;
+    pid_t pid;
+    int fd;                 // our end of the socket pair
+    struct reference_orbit *reference; // last one sent, held
+    float *pixels;          // answer being read, job->pixels stays intact if it fails
+    size_t pixel_capacity;
+};
+
+
+// 1 once `len` bytes are read, 0 at the end of the stream before any, -1 otherwise
+static int remote_read(int fd, void *data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (char*)data + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n == 0 && done == 0 ? 0 : -1;
+        }
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+// The coordinator sends without SIGPIPE: a dead worker is a failed job, not
+// the end of the render. A worker does get it when the coordinator is gone.
+static int remote_write(int fd, const void *data, size_t len, int coordinator) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = coordinator ? send(fd, (const char*)data + done, len - done, MSG_NOSIGNAL)
+                                : write(fd, (const char*)data + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static int remote_write_header(int fd, uint32_t type, size_t length, int coordinator) {
+    struct remote_header header = { REMOTE_MAGIC, type, (uint32_t)length };
+    return remote_write(fd, &header, sizeof(header), coordinator);
+}
+
+static int remote_grow(float **pixels, size_t *capacity, size_t count) {
+    if (count > *capacity) {
+        float *grown = (float*)realloc(*pixels, count * sizeof(grown[0]));
+        if (!grown) {
+            return -1;
+        }
+        *pixels = grown;
+        *capacity = count;
+    }
+    return 0;
+}
+
+
+// Same allocation as reference_orbit_create, so reference_orbit_release frees it
+static struct reference_orbit *remote_read_reference(int in, const struct remote_header *header) {
+    struct remote_reference r;
+    if (header->length < sizeof(r) || remote_read(in, &r, sizeof(r)) != 1 ||
+        r.length < 1 || r.length > r.depth || r.depth > MANDELBROT_DEPTH_MAX ||
+        header->length != sizeof(r) + 2 * (size_t)r.length * sizeof(double)) {
+        return NULL;
+    }
+    struct reference_orbit *ref = (struct reference_orbit*)calloc(1, sizeof(*ref));
+    atomic_init(&ref->refcount, 1);
+    ref->depth = r.depth;
+    ref->length = r.length;
+    ref->series_skip = r.series_skip;
+    ref->series_radius = r.series_radius;
+    memcpy(ref->series, r.series, sizeof(ref->series));
+    ref->z = (double*)malloc(2 * (size_t)r.length * sizeof(ref->z[0]));
+    if (remote_read(in, ref->z, 2 * (size_t)r.length * sizeof(ref->z[0])) != 1) {
+        reference_orbit_release(ref);
+        return NULL;
+    }
+    return ref;
+}
+
+int remote_serve(int in, int out) {
+    const char *fail_env = getenv("MANDELBROT_REMOTE_FAIL");
+    double fail = fail_env ? atof(fail_env) : 0.0;
+    srand((unsigned)getpid());
+    struct reference_orbit *reference = NULL;
+    float *pixels = NULL;
+    size_t capacity = 0;
+    int status = 0;
+    for (;;) {
+        struct remote_header header;
+        int got = remote_read(in, &header, sizeof(header));
+        if (got != 1) {
+            status = got == 0 ? 0 : -1;
+            break;
+        }
+        if (header.magic != REMOTE_MAGIC) {
+            status = -1;
+            break;
+        }
+        if (header.type == REMOTE_REFERENCE) {
+            struct reference_orbit *next = remote_read_reference(in, &header);
+            if (!next) {
+                status = -1;
+                break;
+            }
+            if (reference) {
+                reference_orbit_release(reference);
+            }
+            reference = next;
+            continue;
+        }
+        struct remote_tile tile;
+        if (header.type != REMOTE_TILE || header.length < sizeof(tile) || remote_read(in, &tile, sizeof(tile)) != 1 ||
+            tile.width_px <= 0 || tile.height_px <= 0 || (int64_t)tile.width_px * tile.height_px > REMOTE_MAX_PIXELS ||
+            tile.stride < 1) {
+            status = -1;
+            break;
+        }
+        size_t count = (size_t)tile.width_px * tile.height_px;
+        if (header.length != sizeof(tile) + (tile.refine ? count * sizeof(float) : 0) ||
+            remote_grow(&pixels, &capacity, count) != 0 ||
+            (tile.refine && remote_read(in, pixels, count * sizeof(float)) != 1)) {
+            status = -1;
+            break;
+        }
+        if (fail > 0.0 && rand() < fail * ((double)RAND_MAX + 1.0)) {
+            raise(SIGKILL);
+        }
+        if (tile.perturbed && !reference) {
+            // Nothing to perturb from: the coordinator sends it again
+            if (remote_write_header(out, REMOTE_PIXELS, 0, 0) != 0) {
+                status = -1;
+                break;
+            }
+            continue;
+        }
+        if (tile.perturbed) {
+            compute_mandelbrot_chunk_perturbed_pass(reference, tile.pos, tile.size, tile.width_px, tile.height_px,
+                    tile.stride, tile.refine, NULL, pixels);
+        } else {
+            compute_mandelbrot_chunk_pass(tile.pos, tile.size, tile.width_px, tile.height_px, tile.depth,
+                    tile.stride, tile.refine, NULL, pixels);
+        }
+        if (remote_write_header(out, REMOTE_PIXELS, count * sizeof(float), 0) != 0 ||
+            remote_write(out, pixels, count * sizeof(float), 0) != 0) {
+            status = -1;
+            break;
+        }
+    }
+    if (reference) {
+        reference_orbit_release(reference);
+    }
+    free(pixels);
+    return status;
+}
+
+
+static int remote_worker_spawn(struct remote_worker *worker) {
+    int fds[2];
+    // Close-on-exec from the start: pool threads restart workers concurrently,
+    // and another worker inheriting either end would keep this stream open
+    // after this worker dies. dup2 clears it on the child's stdin/stdout.
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // The pool threads may be running: nothing but exec from here
+        dup2(fds[1], STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        if (fds[1] != STDIN_FILENO && fds[1] != STDOUT_FILENO) {
+            close(fds[1]);
+        }
+        execl("/bin/sh", "sh", "-c", worker->command, (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    worker->pid = pid;
+    worker->fd = fds[0];
+    return 0;
+}
+
+static void remote_worker_end(struct remote_worker *worker, int signal) {
+    if (worker->fd >= 0) {
+        close(worker->fd);
+        worker->fd = -1;
+    }
+    if (worker->pid > 0) {
+        if (signal) {
+            kill(worker->pid, signal);
+        }
+        while (waitpid(worker->pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+        worker->pid = 0;
+    }
+    if (worker->reference) {
+        reference_orbit_release(worker->reference);
+        worker->reference = NULL;
+    }
+}
+
+struct remote_worker *remote_worker_start(const char *command) {
+    struct remote_worker *worker = (struct remote_worker*)calloc(1, sizeof(*worker));
+    worker->command = strdup(command);
+    worker->fd = -1;
+    if (remote_worker_spawn(worker) != 0) {
+        free(worker->command);
+        free(worker);
+        return NULL;
+    }
+    return worker;
+}
+
+int remote_worker_restart(struct remote_worker *worker) {
+    remote_worker_end(worker, SIGKILL);
+    return remote_worker_spawn(worker);
+}
+
+void remote_worker_stop(struct remote_worker *worker) {
+    // A worker idles on its stream, it ends when the stream does
+    remote_worker_end(worker, 0);
+    free(worker->pixels);
+    free(worker->command);
+    free(worker);
+}
+
+const char *remote_worker_command(const struct remote_worker *worker) {
+    return worker->command;
+}
+
+static int remote_send_reference(struct remote_worker *worker, const struct reference_orbit *ref) {
+    struct remote_reference r = { ref->depth, ref->length, ref->series_skip, 0, ref->series_radius, { 0 } };
+    memcpy(r.series, ref->series, sizeof(r.series));
+    size_t orbit_bytes = 2 * (size_t)ref->length * sizeof(ref->z[0]);
+    if (remote_write_header(worker->fd, REMOTE_REFERENCE, sizeof(r) + orbit_bytes, 1) != 0 ||
+        remote_write(worker->fd, &r, sizeof(r), 1) != 0 ||
+        remote_write(worker->fd, ref->z, orbit_bytes, 1) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int remote_worker_compute(struct remote_worker *worker, struct chunk_job *job) {
+    if (worker->fd < 0) {
+        return -1;
+    }
+    // Workers keep the last reference, a view sends it once per worker
+    if (job->reference && job->reference != worker->reference) {
+        if (remote_send_reference(worker, job->reference) != 0) {
+            return -1;
+        }
+        reference_orbit_retain(job->reference);
+        if (worker->reference) {
+            reference_orbit_release(worker->reference);
+        }
+        worker->reference = job->reference;
+    }
+    size_t count = (size_t)job->width_px * job->height_px;
+    struct remote_tile tile = {
+        { job->pos[0], job->pos[1] }, { job->size[0], job->size[1] },
+        job->width_px, job->height_px, job->depth, job->stride, job->refine, job->reference != NULL,
+    };
+    size_t refine_bytes = job->refine ? count * sizeof(float) : 0;
+    if (remote_write_header(worker->fd, REMOTE_TILE, sizeof(tile) + refine_bytes, 1) != 0 ||
+        remote_write(worker->fd, &tile, sizeof(tile), 1) != 0 ||
+        (refine_bytes && remote_write(worker->fd, job->pixels, refine_bytes, 1) != 0)) {
+        return -1;
+    }
+    struct remote_header header;
+    if (remote_read(worker->fd, &header, sizeof(header)) != 1 || header.magic != REMOTE_MAGIC ||
+        header.type != REMOTE_PIXELS || header.length != count * sizeof(float) ||
+        remote_grow(&worker->pixels, &worker->pixel_capacity, count) != 0 ||
+        remote_read(worker->fd, worker->pixels, count * sizeof(float)) != 1) {
+        return -1;
+    }
+    memcpy(job->pixels, worker->pixels, count * sizeof(float));
+    return 0;
+}
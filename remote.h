@@ -0,0 +1,52 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+// Chunk jobs computed by other processes.
+// A worker process serves chunk jobs over a byte stream: its stdin and
+// stdout, connected to the coordinator by a socket pair. The worker is any
+// command run through /bin/sh, `render -x` locally, or e.g.
+// `ssh node ./render -x` on another machine. Messages are a header
+// { REMOTE_MAGIC, type, length } followed by `length` bytes:
+//  - REMOTE_REFERENCE, to the worker: a reference orbit, as computed by the
+//    coordinator (limit, orbit values, series); the perturbed tiles after it
+//    are relative to it
+//  - REMOTE_TILE, to the worker: the inputs of compute_mandelbrot_chunk_pass
+//    (pos, size, pixel size, limit, stride, refine, perturbed), followed by
+//    the pixels of the previous pass when refining
+//  - REMOTE_PIXELS, back: the pixels of the tile, or an empty message if the
+//    worker could not compute it
+// A worker computes one tile at a time, in one thread: start one per core.
+// Values go in the byte order of the coordinator, so the worker has to run
+// on the same architecture; the magic number catches a mismatch.
+//
+// The chunk pool drives the coordinator side (see chunk_pool_create_remote):
+// each pool thread feeds one worker process, so whichever process is free
+// takes the next most urgent job.
+
+#define REMOTE_MAGIC 0x4d424c31u // "MBL1"
+#define REMOTE_REFERENCE 1
+#define REMOTE_TILE 2
+#define REMOTE_PIXELS 3
+
+struct chunk_job;
+struct remote_worker;
+
+// Worker side: serves the jobs read from `in` on `out`, until the
+// coordinator closes the stream (returns 0) or sends garbage (returns -1).
+// MANDELBROT_REMOTE_FAIL=<p> in the environment makes the worker die
+// instead of answering a tile with probability p, to exercise the retries.
+int remote_serve(int in, int out);
+
+// Starts `command` as a worker. NULL if it can not be started
+struct remote_worker *remote_worker_start(const char *command);
+// Kills the process and starts the command again. Returns 0 on success
+int remote_worker_restart(struct remote_worker *worker);
+// Closes the stream, which ends the worker, and waits for it
+void remote_worker_stop(struct remote_worker *worker);
+const char *remote_worker_command(const struct remote_worker *worker);
+// Computes the job in the worker process, into job->pixels. Returns 0, or
+// -1 when the worker failed (died, or answered garbage); the worker then
+// has to be restarted before it is used again
+int remote_worker_compute(struct remote_worker *worker, struct chunk_job *job);
+
+#endif
@@ -0,0 +1,444 @@
+#define _POSIX_C_SOURCE 200809L
+// Headless renderer: computes a view straight to an image file, without a
+// window or a GL context. The image is cut into bands of tiles; the tiles of
+// a few bands are computed by the worker pool at a time and a band is
+// written out as soon as all of its tiles are done, so memory stays bounded
+// by the bands in flight whatever the image size.
+//
+// Zoom mode renders a sequence of frames from one width down to another,
+// around a fixed centre. Rather than computing every frame, it computes a
+// keyframe at twice the frame resolution for every halving of the width;
+// each frame in between is a crop of its keyframe, resampled to the frame
+// size (the crop is 1x to 2x the frame resolution). Frames of one keyframe
+// are resampled and written while the workers compute the next keyframe.
+//
+// Tiles can also go to worker processes (see remote.h): -p starts local
+// ones, -W any command speaking the protocol, e.g. over ssh. `render -x` is
+// such a worker.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mandelbrot.h"
+#include "pool.h"
+#include "perturbation.h"
+#include "image.h"
+#include "depth.h"
+#include "remote.h"
+
+#define RENDER_TILE_PX 256
+#define RENDER_BANDS_MIN 2 // in flight, more if one band has too few tiles to keep every core busy
+#define RENDER_KEYFRAME_SCALE 2 // keyframe resolution over frame resolution, and width ratio between keyframes
+#define RENDER_REMOTE_MAX 256 // worker processes
+
+// What the pool threads are, for the timings
+static const char *render_workers = "threads";
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-c RE,IM] [-w WIDTH] [-s WxH] [-d DEPTH] [-t TILE] [-j THREADS] [-p PROCESSES] [-W COMMAND]... [-o FILE]\n"
+            "       %s -z END_WIDTH -f FRAMES [-n] [options above] -o PATTERN\n"
+            "       %s -x\n"
+            "  -c  view centre, decimal, any number of digits (default -0.6,0)\n"
+            "  -w  view width on the plane (default 2.4)\n"
+            "  -s  image size in pixels (default 1024x1024)\n"
+            "  -d  iteration limit (default: from the width of each view, see depth.h)\n"
+            "  -t  tile side in pixels (default %d)\n"
+            "  -j  worker threads (default: one per core)\n"
+            "  -p  compute in this many local worker processes instead of threads\n"
+            "  -W  also compute in a worker process started by this shell command,\n"
+            "      e.g. 'ssh node ./render -x' (same architecture); repeatable\n"
+            "  -o  output, .png or .pgm (default mandelbrot.png)\n"
+            "  -z  zoom in from -w down to this width, writing a frame sequence\n"
+            "  -f  number of frames of the zoom\n"
+            "  -n  compute every frame from scratch instead of from keyframes\n"
+            "  -o  with -z, printf pattern of the frame files (e.g. frame%%05d.png)\n"
+            "  -x  serve tiles on stdin/stdout as a worker process\n"
+            "The limit used is printed with the timings, -d with it renders the same image.\n",
+            argv0, argv0, argv0, RENDER_TILE_PX);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Splits "RE,IM" and parses both parts. Returns 0 on success
+static int parse_centre(const char *arg, struct bignum centre[2]) {
+    char re[256];
+    const char *comma = strchr(arg, ',');
+    if (!comma || comma - arg >= (long)sizeof(re)) {
+        return -1;
+    }
+    memcpy(re, arg, comma - arg);
+    re[comma - arg] = '\0';
+    if (bignum_from_string(&centre[0], re, BIGNUM_MAX_LIMBS) != 0) {
+        return -1;
+    }
+    return bignum_from_string(&centre[1], comma + 1, BIGNUM_MAX_LIMBS);
+}
+
+
+// A view to compute: `width` (on the plane) around the centre, in
+// width_px x height_px square pixels
+struct render_view {
+    const struct bignum *centre;
+    double centre_d[2];
+    double width;
+    double height;
+    double step;
+    int width_px;
+    int height_px;
+    int depth;
+    struct reference_orbit *reference;  // deep views only
+};
+
+// `depth` 0 picks the limit from the width
+static void render_view_init(struct render_view *view, const struct bignum centre[2], double width, int width_px, int height_px, int depth) {
+    view->centre = centre;
+    view->centre_d[0] = bignum_to_double(&centre[0], BIGNUM_MAX_LIMBS);
+    view->centre_d[1] = bignum_to_double(&centre[1], BIGNUM_MAX_LIMBS);
+    view->width = width;
+    view->step = width / width_px;
+    view->height = view->step * height_px;
+    view->width_px = width_px;
+    view->height_px = height_px;
+    view->depth = depth > 0 ? depth : depth_for_width(width);
+    view->reference = NULL;
+    double pos[2] = { view->centre_d[0] - width / 2, view->centre_d[1] + view->height / 2 };
+    double size[2] = { width, view->height };
+    if (perturbation_needed(pos, size, width_px, height_px)) {
+        view->reference = reference_orbit_create(centre, bignum_limbs_for_step(view->step), view->depth);
+        reference_orbit_approximate(view->reference, hypot(width, view->height) / 2, view->step);
+    }
+}
+
+static void render_view_release(struct render_view *view) {
+    if (view->reference) {
+        reference_orbit_release(view->reference);
+    }
+}
+
+static const char *render_view_mode(const struct render_view *view) {
+    if (view->reference) {
+        return "perturbation";
+    }
+    double pos[2] = { view->centre_d[0] - view->width / 2, view->centre_d[1] + view->height / 2 };
+    double size[2] = { view->width, view->height };
+    return mandelbrot_precision_name(mandelbrot_select_precision(pos, size, view->width_px, view->height_px));
+}
+
+// Queue tile (tx, ty) of the view, cut in tile_px squares (smaller at the
+// right and bottom edges). The job key holds the tile and `tag`.
+static void render_view_submit(struct chunk_pool *pool, const struct render_view *view, int tile_px, int tx, int ty, int tag) {
+    int x0 = tx * tile_px;
+    int y0 = ty * tile_px;
+    int tile_w = view->width_px - x0 < tile_px ? view->width_px - x0 : tile_px;
+    int tile_h = view->height_px - y0 < tile_px ? view->height_px - y0 : tile_px;
+    double pos[2] = { -view->width / 2 + x0 * view->step, view->height / 2 - y0 * view->step };
+    if (!view->reference) {
+        pos[0] += view->centre_d[0];
+        pos[1] += view->centre_d[1];
+    }
+    double size[2] = { tile_w * view->step, tile_h * view->step };
+    struct tile_key key = { 0, tag, tx, ty, view->depth };
+    struct chunk_job *job = chunk_job_create(pos, size, tile_w, tile_h, &key, chunk_pool_generation(pool), view->reference);
+    job->depth = view->depth;
+    chunk_pool_submit(pool, job);
+}
+
+static int render_still(struct chunk_pool *pool, const struct render_view *view, int tile_px, const char *path) {
+    struct image_writer *writer = image_writer_open(path, view->width_px, view->height_px);
+    if (!writer) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return -1;
+    }
+    int width_px = view->width_px;
+    int tiles_across = (width_px + tile_px - 1) / tile_px;
+    int band_count = (view->height_px + tile_px - 1) / tile_px;
+    int bands_in_flight = (2 * chunk_pool_thread_count(pool) + tiles_across - 1) / tiles_across;
+    if (bands_in_flight < RENDER_BANDS_MIN) {
+        bands_in_flight = RENDER_BANDS_MIN;
+    }
+    // Ring of band buffers, band b lives in slot b % bands_in_flight
+    unsigned char *bands = (unsigned char*)malloc((size_t)bands_in_flight * tile_px * width_px);
+    int *tiles_left = (int*)calloc(bands_in_flight, sizeof(tiles_left[0]));
+
+    double start = now_seconds();
+    int status = 0;
+    int submitted = 0;
+    for (int written = 0; written < band_count; ) {
+        while (submitted < band_count && submitted < written + bands_in_flight) {
+            for (int tx = 0; tx < tiles_across; tx++) {
+                render_view_submit(pool, view, tile_px, tx, submitted, 0);
+            }
+            tiles_left[submitted % bands_in_flight] = tiles_across;
+            submitted++;
+        }
+        struct chunk_job *job = chunk_pool_wait(pool);
+        unsigned char *band = &bands[(size_t)(job->key.y % bands_in_flight) * tile_px * width_px];
+        int x0 = (int)job->key.x * tile_px;
+        for (int i = 0; i < job->height_px; i++) {
+            for (int j = 0; j < job->width_px; j++) {
+                band[(size_t)i * width_px + x0 + j] = (unsigned char)(job->pixels[i * job->width_px + j] * 255.0f);
+            }
+        }
+        tiles_left[job->key.y % bands_in_flight]--;
+        chunk_job_free(job);
+        // Bands go out in order; a later band may be done first
+        while (written < submitted && tiles_left[written % bands_in_flight] == 0) {
+            int band_h = view->height_px - written * tile_px < tile_px ? view->height_px - written * tile_px : tile_px;
+            if (status == 0 && image_writer_rows(writer, &bands[(size_t)(written % bands_in_flight) * tile_px * width_px], band_h) != 0) {
+                status = -1;
+            }
+            written++;
+        }
+    }
+    double seconds = now_seconds() - start;
+    if (image_writer_close(writer) != 0) {
+        status = -1;
+    }
+    if (status != 0) {
+        fprintf(stderr, "writing %s failed\n", path);
+    }
+    double pixels = (double)width_px * view->height_px;
+    printf("%s: %dx%d px in %.3f s, %.2f Mpixels/s, %d %s, %s kernel, %s, depth %d\n",
+            path, width_px, view->height_px, seconds, pixels / seconds * 1e-6, chunk_pool_thread_count(pool), render_workers, mandelbrot_kernel_name(),
+            render_view_mode(view), view->depth);
+    free(tiles_left);
+    free(bands);
+    return status;
+}
+
+
+// Keyframe of a zoom: a view, and its pixels once all tiles are in
+struct render_keyframe {
+    struct render_view view;
+    float *pixels;
+    int tiles_left;
+};
+
+static void render_keyframe_collect(struct render_keyframe *keyframes, int tile_px, struct chunk_job *job) {
+    struct render_keyframe *keyframe = &keyframes[job->key.level];
+    int width_px = keyframe->view.width_px;
+    int x0 = (int)job->key.x * tile_px;
+    int y0 = (int)job->key.y * tile_px;
+    for (int i = 0; i < job->height_px; i++) {
+        memcpy(&keyframe->pixels[(size_t)(y0 + i) * width_px + x0], &job->pixels[i * job->width_px], job->width_px * sizeof(float));
+    }
+    keyframe->tiles_left--;
+    chunk_job_free(job);
+}
+
+// Frame of `width` (around the same centre as the keyframe), bilinear
+static void render_resample(const struct render_keyframe *keyframe, double width, int width_px, int height_px, unsigned char *frame) {
+    const struct render_view *key = &keyframe->view;
+    double scale = width / width_px / key->step; // keyframe pixels per frame pixel
+    for (int i = 0; i < height_px; i++) {
+        double v = key->height_px / 2.0 + (i + 0.5 - height_px / 2.0) * scale - 0.5;
+        int v0 = (int)floor(v);
+        double fv = v - v0;
+        int r0 = v0 < 0 ? 0 : v0;
+        int r1 = v0 + 1 >= key->height_px ? key->height_px - 1 : v0 + 1;
+        for (int j = 0; j < width_px; j++) {
+            double u = key->width_px / 2.0 + (j + 0.5 - width_px / 2.0) * scale - 0.5;
+            int u0 = (int)floor(u);
+            double fu = u - u0;
+            int c0 = u0 < 0 ? 0 : u0;
+            int c1 = u0 + 1 >= key->width_px ? key->width_px - 1 : u0 + 1;
+            const float *p0 = &keyframe->pixels[(size_t)r0 * key->width_px];
+            const float *p1 = &keyframe->pixels[(size_t)r1 * key->width_px];
+            double value = (1 - fv) * ((1 - fu) * p0[c0] + fu * p0[c1]) + fv * ((1 - fu) * p1[c0] + fu * p1[c1]);
+            frame[(size_t)i * width_px + j] = (unsigned char)(value * 255.0 + 0.5);
+        }
+    }
+}
+
+static void render_keyframe_submit(struct chunk_pool *pool, struct render_keyframe *keyframes, int k, int tile_px) {
+    struct render_keyframe *keyframe = &keyframes[k];
+    int tiles_across = (keyframe->view.width_px + tile_px - 1) / tile_px;
+    int tiles_down = (keyframe->view.height_px + tile_px - 1) / tile_px;
+    keyframe->pixels = (float*)malloc((size_t)keyframe->view.width_px * keyframe->view.height_px * sizeof(float));
+    keyframe->tiles_left = tiles_across * tiles_down;
+    for (int ty = 0; ty < tiles_down; ty++) {
+        for (int tx = 0; tx < tiles_across; tx++) {
+            render_view_submit(pool, &keyframe->view, tile_px, tx, ty, k);
+        }
+    }
+}
+
+// Frames go from width0 to width1 geometrically. With `reuse`, a keyframe
+// is as wide as the first frame it serves and serves the following ones
+// down to 1 / RENDER_KEYFRAME_SCALE of that; without, every frame is a
+// keyframe of its own, at the frame resolution.
+static int render_zoom(struct chunk_pool *pool, const struct bignum centre[2], double width0, double width1, int frame_count, int reuse,
+        int width_px, int height_px, int depth, int tile_px, const char *pattern) {
+    double *widths = (double*)malloc(frame_count * sizeof(widths[0]));
+    int *sources = (int*)malloc(frame_count * sizeof(sources[0]));
+    struct render_keyframe *keyframes = (struct render_keyframe*)calloc(frame_count, sizeof(keyframes[0]));
+    int keyframe_count = 0;
+    for (int f = 0; f < frame_count; f++) {
+        widths[f] = frame_count > 1 ? width0 * pow(width1 / width0, (double)f / (frame_count - 1)) : width0;
+        if (!reuse) {
+            render_view_init(&keyframes[keyframe_count++].view, centre, widths[f], width_px, height_px, depth);
+        } else if (keyframe_count == 0 ||
+                widths[f] < keyframes[keyframe_count - 1].view.width / RENDER_KEYFRAME_SCALE * (1 - 1e-9)) {
+            // The last keyframe no longer has the resolution for this frame
+            render_view_init(&keyframes[keyframe_count++].view, centre, widths[f],
+                    width_px * RENDER_KEYFRAME_SCALE, height_px * RENDER_KEYFRAME_SCALE, depth);
+        }
+        sources[f] = keyframe_count - 1;
+    }
+
+    // Keyframes are released as they go
+    int depth_first = keyframes[0].view.depth;
+    int depth_last = keyframes[keyframe_count - 1].view.depth;
+    double start = now_seconds();
+    int status = 0;
+    unsigned char *frame = (unsigned char*)malloc((size_t)width_px * height_px);
+    char path[4096];
+    int f = 0;
+    render_keyframe_submit(pool, keyframes, 0, tile_px);
+    for (int k = 0; k < keyframe_count; k++) {
+        while (keyframes[k].tiles_left > 0) {
+            render_keyframe_collect(keyframes, tile_px, chunk_pool_wait(pool));
+        }
+        // The workers go on with the next keyframe while this one is written out
+        if (k + 1 < keyframe_count) {
+            render_keyframe_submit(pool, keyframes, k + 1, tile_px);
+        }
+        for (; f < frame_count && sources[f] == k; f++) {
+            render_resample(&keyframes[k], widths[f], width_px, height_px, frame);
+            snprintf(path, sizeof(path), pattern, f);
+            struct image_writer *writer = image_writer_open(path, width_px, height_px);
+            if (!writer || image_writer_rows(writer, frame, height_px) != 0 || image_writer_close(writer) != 0) {
+                fprintf(stderr, "writing %s failed\n", path);
+                status = -1;
+            }
+            struct chunk_job *job;
+            while ((job = chunk_pool_poll(pool))) {
+                render_keyframe_collect(keyframes, tile_px, job);
+            }
+        }
+        free(keyframes[k].pixels);
+        keyframes[k].pixels = NULL;
+        render_view_release(&keyframes[k].view);
+    }
+    double seconds = now_seconds() - start;
+    printf("%d frames of %dx%d px in %.3f s, %.1f frames/min, %d %s, %d %s, %s kernel, depth %d to %d\n",
+            frame_count, width_px, height_px, seconds, frame_count / seconds * 60, keyframe_count,
+            reuse ? "keyframes" : "independent renders", chunk_pool_thread_count(pool), render_workers, mandelbrot_kernel_name(),
+            depth_first, depth_last);
+    free(frame);
+    free(keyframes);
+    free(sources);
+    free(widths);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    struct bignum centre[2];
+    bignum_from_double(&centre[0], -0.6);
+    bignum_from_double(&centre[1], 0.0);
+    double width = 2.4;
+    int width_px = 1024;
+    int height_px = 1024;
+    int depth = 0;
+    int tile_px = RENDER_TILE_PX;
+    int threads = 0;
+    const char *path = "mandelbrot.png";
+    double end_width = 0.0;
+    int frame_count = 0;
+    int reuse = 1;
+    int processes = 0;
+    const char *commands[RENDER_REMOTE_MAX];
+    int command_count = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:w:s:d:t:j:p:W:o:z:f:nxh")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (parse_centre(optarg, centre) != 0) {
+                fprintf(stderr, "bad centre '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w': width = strtod(optarg, NULL); break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width_px, &height_px) != 2) {
+                fprintf(stderr, "bad size '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd': depth = atoi(optarg); break;
+        case 't': tile_px = atoi(optarg); break;
+        case 'j': threads = atoi(optarg); break;
+        case 'p': processes = atoi(optarg); break;
+        case 'W':
+            if (command_count == RENDER_REMOTE_MAX) {
+                fprintf(stderr, "more than %d worker commands\n", RENDER_REMOTE_MAX);
+                return 1;
+            }
+            commands[command_count++] = optarg;
+            break;
+        case 'x':
+            // Nothing but the protocol on stdout
+            return remote_serve(STDIN_FILENO, STDOUT_FILENO) == 0 ? 0 : 1;
+        case 'o': path = optarg; break;
+        case 'z': end_width = strtod(optarg, NULL); break;
+        case 'f': frame_count = atoi(optarg); break;
+        case 'n': reuse = 0; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    int zoom = end_width != 0.0 || frame_count != 0;
+    if (optind != argc || !(width > 0) || width_px <= 0 || height_px <= 0 || tile_px <= 0 || depth < 0 ||
+        processes < 0 || processes + command_count > RENDER_REMOTE_MAX ||
+        (zoom && (!(end_width > 0 && end_width < width) || frame_count <= 0 || !strchr(path, '%')))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct chunk_pool *pool;
+    if (processes + command_count > 0) {
+        // Local workers are this program, run again
+        char local[4096];
+        snprintf(local, sizeof(local), "exec '%s' -x", argv[0]);
+        struct remote_worker *remotes[RENDER_REMOTE_MAX];
+        int count = 0;
+        for (int i = 0; i < processes + command_count; i++) {
+            const char *command = i < processes ? local : commands[i - processes];
+            remotes[count] = remote_worker_start(command);
+            if (!remotes[count]) {
+                fprintf(stderr, "worker process '%s' can not be started\n", command);
+                continue;
+            }
+            count++;
+        }
+        if (count == 0) {
+            return 1;
+        }
+        pool = chunk_pool_create_remote(remotes, count);
+        render_workers = "worker processes";
+    } else {
+        pool = chunk_pool_create(threads);
+    }
+    int status;
+    if (zoom) {
+        status = render_zoom(pool, centre, width, end_width, frame_count, reuse, width_px, height_px, depth, tile_px, path);
+    } else {
+        struct render_view view;
+        render_view_init(&view, centre, width, width_px, height_px, depth);
+        status = render_still(pool, &view, tile_px, path);
+        render_view_release(&view);
+    }
+    chunk_pool_destroy(pool);
+    return status == 0 ? 0 : 1;
+}
+
@@ -3,8 +3,20 @@
 in vec3 fTexcoord;
 out vec4 outColor;
 uniform sampler2DArray chunk_array;
+uniform sampler1D palette;
+uniform float palette_period; // escape iterations per palette cycle
+uniform float palette_offset; // in [0, 1), moves while the palette cycles
+
+// As the kernels write them (see mandelbrot.h): 0 inside the set, otherwise
+// log2(1 + mu) / VALUE_OCTAVES for the smooth escape count mu
+const float VALUE_OCTAVES = 16.0;
 
 void main() {
-    outColor = texture(chunk_array, fTexcoord).rrrr;
+    float value = texture(chunk_array, fTexcoord).r;
+    if (value == 0.0) {
+        outColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+    float mu = exp2(value * VALUE_OCTAVES) - 1.0;
+    outColor = texture(palette, mu / palette_period + palette_offset);
 }
-
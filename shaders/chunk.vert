@@ -2,11 +2,12 @@
 
 in dvec2 position;
 in double chunk_index;
+in double chunk_side;
 out float gChunkIndex;
+out vec2 gChunkSize;
 
 layout(std140, binding = 0) uniform shader_data {
     dvec4 window_rec; // values: { x, y, w, h }
-    dvec2 chunk_size; // values: { width, height }
 };
 
 void main() {
@@ -14,6 +15,9 @@ void main() {
     // gChunkIndex = 0.0f;
     // normalize position to (-1, 1), relative to window position
     vec2 p = vec2(2 * (position.xy - window_rec.xy) / window_rec.zw - 1);
+    // Chunks of any grid level: previews of another level are scaled to
+    // where their tiles lie on the plane
+    gChunkSize = vec2(2 * dvec2(chunk_side) / window_rec.zw);
     // hide chunks that are uninitialized
     if (chunk_index == 0.0f) {
         gl_Position = vec4(p, -100.0, 1.0);
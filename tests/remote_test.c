@@ -0,0 +1,105 @@
+#define _POSIX_C_SOURCE 200809L
+// Worker process failures: every worker process dies with SIGKILL on the
+// first tile it is sent, after reading it. The jobs they held have to be
+// requeued and computed again by the restarted workers, to the same pixels
+// as computed here. A worker stream inherited by another worker process
+// would never report the death: the alarm turns that hang into a failure.
+// `make check` builds and runs it; `remote_test -x FLAG` is the worker.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "mandelbrot.h"
+#include "pool.h"
+#include "remote.h"
+
+#define TEST_WORKERS 4
+#define TEST_JOBS 16
+#define TEST_PX 128
+#define TEST_DEPTH 300
+#define TEST_TIMEOUT 60 // seconds
+
+// Worker: dies on its first tile the first time it runs (FLAG does not
+// exist yet), serves normally once restarted
+static int test_worker(const char *flag) {
+    // Sockets other than its own stream are worker streams leaked into it
+    for (int fd = 3; fd < 1024; fd++) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "worker process inherited socket %d\n", fd);
+            return 1;
+        }
+    }
+    int fd = open(flag, O_CREAT | O_EXCL | O_WRONLY, 0600);
+    if (fd >= 0) {
+        close(fd);
+        setenv("MANDELBROT_REMOTE_FAIL", "1", 1);
+    } else {
+        unsetenv("MANDELBROT_REMOTE_FAIL");
+    }
+    return remote_serve(STDIN_FILENO, STDOUT_FILENO) == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "-x") == 0) {
+        return test_worker(argv[2]);
+    }
+    alarm(TEST_TIMEOUT);
+    char dir[] = "/tmp/remote_test.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char flags[TEST_WORKERS][sizeof(dir) + 16];
+    struct remote_worker *remotes[TEST_WORKERS];
+    for (int i = 0; i < TEST_WORKERS; i++) {
+        char command[4096];
+        snprintf(flags[i], sizeof(flags[i]), "%s/%d", dir, i);
+        snprintf(command, sizeof(command), "exec '%s' -x '%s'", argv[0], flags[i]);
+        remotes[i] = remote_worker_start(command);
+        if (!remotes[i]) {
+            fprintf(stderr, "worker process '%s' can not be started\n", command);
+            return 1;
+        }
+    }
+    struct chunk_pool *pool = chunk_pool_create_remote(remotes, TEST_WORKERS);
+    // A row of tiles across the set, all with escaping pixels
+    for (int i = 0; i < TEST_JOBS; i++) {
+        double pos[2] = { -2.0 + i * (2.5 / TEST_JOBS), -0.5 };
+        double size[2] = { 2.5 / TEST_JOBS, 1.0 };
+        struct tile_key key = { 0 };
+        struct chunk_job *job = chunk_job_create(pos, size, TEST_PX, TEST_PX, &key, chunk_pool_generation(pool), NULL);
+        job->depth = TEST_DEPTH;
+        chunk_pool_submit(pool, job);
+    }
+    int failures = 0;
+    int wrong = 0;
+    float *expected = (float*)malloc(TEST_PX * TEST_PX * sizeof(expected[0]));
+    for (int i = 0; i < TEST_JOBS; i++) {
+        struct chunk_job *job = chunk_pool_wait(pool);
+        compute_mandelbrot_chunk_pass(job->pos, job->size, TEST_PX, TEST_PX, TEST_DEPTH, 1, 0, NULL, expected);
+        if (memcmp(expected, job->pixels, TEST_PX * TEST_PX * sizeof(expected[0])) != 0) {
+            fprintf(stderr, "job at %g, %g: pixels differ from a local compute\n", job->pos[0], job->pos[1]);
+            wrong++;
+        }
+        failures += job->attempts;
+        chunk_job_free(job);
+    }
+    free(expected);
+    chunk_pool_destroy(pool);
+    for (int i = 0; i < TEST_WORKERS; i++) {
+        unlink(flags[i]);
+    }
+    rmdir(dir);
+
+    // Each worker dies once at most: more failures are restarted workers failing again
+    int ok = wrong == 0 && failures >= 1 && failures <= TEST_WORKERS;
+    printf("%s: %d jobs, %d requeued after a worker process died, %d wrong\n",
+            ok ? "PASS" : "FAIL", TEST_JOBS, failures, wrong);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+#include "tilecache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define TILE_CACHE_INITIAL_BUCKETS 1024
+
+struct tile_cache {
+    struct tile **buckets;
+    size_t bucket_count;    // power of two
+    int count;
+    size_t bytes;
+    size_t budget_bytes;
+    int tile_len;
+    // LRU list, head is the most recently used
+    struct tile *lru_head;
+    struct tile *lru_tail;
+    // Texture array residency
+    struct tile **layer_owner;
+    int layer_count;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+
+double tile_side(int level) {
+    return ldexp(TILE_ROOT_SIZE, -level);
+}
+
+int tile_key_equal(const struct tile_key *a, const struct tile_key *b) {
+    return a->anchor == b->anchor && a->level == b->level && a->x == b->x && a->y == b->y && a->depth == b->depth;
+}
+
+size_t tile_key_hash(const struct tile_key *key) {
+    uint64_t h = (uint64_t)key->anchor * 0x9e3779b97f4a7c15ull;
+    h ^= (uint64_t)key->level + 0x7f4a7c159e3779b9ull + (h << 6) + (h >> 2);
+    h ^= (uint64_t)key->x * 0xbf58476d1ce4e5b9ull + (h << 6) + (h >> 2);
+    h ^= (uint64_t)key->y * 0x94d049bb133111ebull + (h << 6) + (h >> 2);
+    h ^= (uint64_t)key->depth + (h << 6) + (h >> 2);
+    return (size_t)(h ^ (h >> 31));
+}
+
+static size_t tile_bytes(const struct tile_cache *cache) {
+    return sizeof(struct tile) + cache->tile_len * sizeof(float);
+}
+
+
+static void lru_unlink(struct tile_cache *cache, struct tile *tile) {
+    if (tile->lru_prev) tile->lru_prev->lru_next = tile->lru_next;
+    else cache->lru_head = tile->lru_next;
+    if (tile->lru_next) tile->lru_next->lru_prev = tile->lru_prev;
+    else cache->lru_tail = tile->lru_prev;
+    tile->lru_prev = NULL;
+    tile->lru_next = NULL;
+}
+
+static void lru_push_front(struct tile_cache *cache, struct tile *tile) {
+    tile->lru_prev = NULL;
+    tile->lru_next = cache->lru_head;
+    if (cache->lru_head) cache->lru_head->lru_prev = tile;
+    else cache->lru_tail = tile;
+    cache->lru_head = tile;
+}
+
+static void tile_cache_grow(struct tile_cache *cache) {
+    size_t bucket_count = 2 * cache->bucket_count;
+    struct tile **buckets = (struct tile**)calloc(bucket_count, sizeof(buckets[0]));
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        struct tile *tile = cache->buckets[i];
+        while (tile) {
+            struct tile *next = tile->hash_next;
+            size_t b = tile_key_hash(&tile->key) & (bucket_count - 1);
+            tile->hash_next = buckets[b];
+            buckets[b] = tile;
+            tile = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+static void tile_cache_remove(struct tile_cache *cache, struct tile *tile) {
+    struct tile **link = &cache->buckets[tile_key_hash(&tile->key) & (cache->bucket_count - 1)];
+    while (*link != tile) {
+        link = &(*link)->hash_next;
+    }
+    *link = tile->hash_next;
+    lru_unlink(cache, tile);
+    if (tile->layer) {
+        cache->layer_owner[tile->layer] = NULL;
+    }
+    cache->count--;
+    cache->bytes -= tile_bytes(cache);
+    free(tile);
+}
+
+// Drop least recently used tiles until the cache fits its budget again
+static void tile_cache_evict(struct tile_cache *cache, unsigned stamp) {
+    struct tile *tile = cache->lru_tail;
+    while (tile && cache->bytes > cache->budget_bytes) {
+        struct tile *prev = tile->lru_prev;
+        // The list is ordered by use, everything from here on is in view
+        if (tile->stamp == stamp) {
+            break;
+        }
+        tile_cache_remove(cache, tile);
+        tile = prev;
+    }
+}
+
+
+struct tile_cache *tile_cache_create(size_t budget_bytes, int layer_count, int tile_len) {
+    struct tile_cache *cache = (struct tile_cache*)calloc(1, sizeof(*cache));
+    cache->bucket_count = TILE_CACHE_INITIAL_BUCKETS;
+    cache->buckets = (struct tile**)calloc(cache->bucket_count, sizeof(cache->buckets[0]));
+    cache->budget_bytes = budget_bytes;
+    cache->tile_len = tile_len;
+    cache->layer_count = layer_count;
+    cache->layer_owner = (struct tile**)calloc(layer_count, sizeof(cache->layer_owner[0]));
+    return cache;
+}
+
+void tile_cache_destroy(struct tile_cache *cache) {
+    struct tile *tile = cache->lru_head;
+    while (tile) {
+        struct tile *next = tile->lru_next;
+        free(tile);
+        tile = next;
+    }
+    free(cache->layer_owner);
+    free(cache->buckets);
+    free(cache);
+}
+
+struct tile *tile_cache_find(const struct tile_cache *cache, const struct tile_key *key) {
+    struct tile *tile = cache->buckets[tile_key_hash(key) & (cache->bucket_count - 1)];
+    while (tile && !tile_key_equal(&tile->key, key)) {
+        tile = tile->hash_next;
+    }
+    return tile;
+}
+
+struct tile *tile_cache_lookup(struct tile_cache *cache, const struct tile_key *key) {
+    struct tile *tile = tile_cache_find(cache, key);
+    if (tile) cache->hits++;
+    else cache->misses++;
+    return tile;
+}
+
+struct tile *tile_cache_insert(struct tile_cache *cache, const struct tile_key *key, const float *pixels, int stride, unsigned stamp) {
+    size_t b = tile_key_hash(key) & (cache->bucket_count - 1);
+    for (struct tile *tile = cache->buckets[b]; tile; tile = tile->hash_next) {
+        if (tile_key_equal(&tile->key, key)) {
+            tile_cache_touch(cache, tile, stamp);
+            if (stride < tile->stride) {
+                memcpy(tile->pixels, pixels, cache->tile_len * sizeof(float));
+                tile->stride = stride;
+                if (tile->layer) {
+                    cache->layer_owner[tile->layer] = NULL;
+                    tile->layer = 0;
+                }
+            }
+            return tile;
+        }
+    }
+    // Pixels live right behind the tile, one allocation per tile
+    struct tile *tile = (struct tile*)malloc(tile_bytes(cache));
+    tile->key = *key;
+    tile->pixels = (float*)(tile + 1);
+    memcpy(tile->pixels, pixels, cache->tile_len * sizeof(float));
+    tile->stride = stride;
+    tile->refining = 0;
+    tile->layer = 0;
+    tile->stamp = stamp;
+    tile->hash_next = cache->buckets[b];
+    cache->buckets[b] = tile;
+    lru_push_front(cache, tile);
+    cache->count++;
+    cache->bytes += tile_bytes(cache);
+    if ((size_t)cache->count > 2 * cache->bucket_count) {
+        tile_cache_grow(cache);
+    }
+    // The new tile is in front and safe unless the budget is below one view
+    tile_cache_evict(cache, stamp);
+    return tile;
+}
+
+void tile_cache_touch(struct tile_cache *cache, struct tile *tile, unsigned stamp) {
+    tile->stamp = stamp;
+    lru_unlink(cache, tile);
+    lru_push_front(cache, tile);
+}
+
+int tile_cache_acquire_layer(struct tile_cache *cache, struct tile *tile, unsigned stamp, int *needs_upload) {
+    *needs_upload = 0;
+    if (tile->layer) {
+        return tile->layer;
+    }
+    int layer = 0;
+    struct tile *victim = NULL;
+    for (int i = 1; i < cache->layer_count; i++) {
+        struct tile *owner = cache->layer_owner[i];
+        if (!owner) {
+            layer = i;
+            victim = NULL;
+            break;
+        }
+        // Oldest stamp that is not the current view (stamps only grow)
+        if (owner->stamp != stamp && (!victim || owner->stamp < victim->stamp)) {
+            layer = i;
+            victim = owner;
+        }
+    }
+    if (!layer) {
+        return 0;
+    }
+    if (victim) {
+        victim->layer = 0;
+    }
+    cache->layer_owner[layer] = tile;
+    tile->layer = layer;
+    *needs_upload = 1;
+    return layer;
+}
+
+size_t tile_cache_bytes(const struct tile_cache *cache) {
+    return cache->bytes;
+}
+
+int tile_cache_count(const struct tile_cache *cache) {
+    return cache->count;
+}
+
+unsigned long tile_cache_hits(const struct tile_cache *cache) {
+    return cache->hits;
+}
+
+unsigned long tile_cache_misses(const struct tile_cache *cache) {
+    return cache->misses;
+}
@@ -0,0 +1,73 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Cache of computed chunks ("tiles") on a fixed quadtree grid of the plane.
+// A tile of level L has the side TILE_ROOT_SIZE / 2^L and covers
+// [x * side, (x + 1) * side] x [y * side, (y + 1) * side], relative to an
+// anchor point, identified by a digest of its coordinates. The anchor is
+// usually the origin of the plane; deep views, too far from it for double
+// offsets, get their own anchor (see main.c).
+//
+// Tiles are kept in CPU memory under a byte budget, least recently used
+// first out. Separately, a tile can be resident in a layer of the GPU
+// texture array; layers are handed out from a fixed number and taken back
+// from the least recently used resident tile. Tiles used by the current
+// view (stamp == current stamp) are never evicted from either.
+
+#define TILE_ROOT_SIZE 4.0
+
+struct tile_key {
+    uint64_t anchor;
+    int level;
+    int64_t x;
+    int64_t y;
+    int depth;              // iteration limit the tile is computed with
+};
+
+struct tile {
+    struct tile_key key;
+    float *pixels;
+    int stride;             // progressive pass the pixels are from, 1 when complete
+    unsigned refining;      // caller's mark for a finer pass in flight
+    int layer;              // texture array layer, 0 when not resident
+    unsigned stamp;         // last view that used the tile
+    struct tile *hash_next;
+    struct tile *lru_prev;  // towards the most recently used
+    struct tile *lru_next;
+};
+
+struct tile_cache;
+
+// Layer 0 is reserved for the placeholder, layers 1 .. layer_count - 1 are managed
+struct tile_cache *tile_cache_create(size_t budget_bytes, int layer_count, int tile_len);
+void tile_cache_destroy(struct tile_cache *cache);
+
+double tile_side(int level);
+int tile_key_equal(const struct tile_key *a, const struct tile_key *b);
+size_t tile_key_hash(const struct tile_key *key);
+
+struct tile *tile_cache_lookup(struct tile_cache *cache, const struct tile_key *key);
+// Same, without counting a hit or a miss: for lookups that are not the view's
+struct tile *tile_cache_find(const struct tile_cache *cache, const struct tile_key *key);
+// Copies `pixels` (tile_len values) of the progressive pass `stride`. A tile
+// cached from a coarser pass is updated, and drops its texture layer so the
+// new pixels get uploaded; otherwise the existing tile is returned as it is.
+struct tile *tile_cache_insert(struct tile_cache *cache, const struct tile_key *key, const float *pixels, int stride, unsigned stamp);
+// Mark the tile as used by the view `stamp`
+void tile_cache_touch(struct tile_cache *cache, struct tile *tile, unsigned stamp);
+// Give the tile a texture layer, evicting the least recently used resident
+// tile of an older view if needed. Returns the layer, or 0 if every layer
+// is in use by the current view. *needs_upload is set when the layer is new
+// to the tile and the caller has to upload its pixels.
+int tile_cache_acquire_layer(struct tile_cache *cache, struct tile *tile, unsigned stamp, int *needs_upload);
+
+// Statistics
+size_t tile_cache_bytes(const struct tile_cache *cache);
+int tile_cache_count(const struct tile_cache *cache);
+unsigned long tile_cache_hits(const struct tile_cache *cache);
+unsigned long tile_cache_misses(const struct tile_cache *cache);
+
+#endif
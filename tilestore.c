@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tilestore.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TILE_STORE_MAGIC "MBTILES"
+#define TILE_RECORD_MAGIC 0x454c4954u // "TILE"
+#define TILE_STORE_INITIAL_CAPACITY 1024
+
+struct tile_store_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t width_px;
+    uint32_t height_px;
+    uint32_t record_size;
+    uint32_t reserved[4];
+};
+
+// Followed by the pixels, padded to 8 bytes
+struct tile_record {
+    uint32_t magic;
+    int32_t level;
+    uint64_t checksum;  // of everything after this field, pixels included
+    uint64_t anchor;
+    int64_t x;
+    int64_t y;
+    int32_t mode;
+    int32_t depth;
+};
+
+struct tile_store_entry {
+    struct tile_key key;
+    int mode;           // -1 once the record turned out to be corrupt
+    off_t offset;       // 0 for an empty slot
+};
+
+struct tile_store {
+    int fd;
+    const unsigned char *map;
+    size_t map_size;
+    off_t file_size;
+    size_t record_size;
+    int tile_len;
+    // Open addressing, key -> latest record
+    struct tile_store_entry *entries;
+    size_t capacity;    // power of two
+    int count;
+    unsigned char *scratch; // one record, for appends
+};
+
+
+static uint64_t tile_record_checksum(const struct tile_record *record, size_t record_size) {
+    const unsigned char *p = (const unsigned char*)&record->anchor;
+    size_t len = record_size - offsetof(struct tile_record, anchor);
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static struct tile_store_entry *tile_store_find(const struct tile_store *store, const struct tile_key *key) {
+    size_t i = tile_key_hash(key) & (store->capacity - 1);
+    while (store->entries[i].offset && !tile_key_equal(&store->entries[i].key, key)) {
+        i = (i + 1) & (store->capacity - 1);
+    }
+    return &store->entries[i];
+}
+
+static void tile_store_index(struct tile_store *store, const struct tile_key *key, int mode, off_t offset) {
+    if (2 * (size_t)(store->count + 1) > store->capacity) {
+        struct tile_store_entry *old = store->entries;
+        size_t old_capacity = store->capacity;
+        store->capacity *= 2;
+        store->entries = (struct tile_store_entry*)calloc(store->capacity, sizeof(store->entries[0]));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].offset) {
+                *tile_store_find(store, &old[i].key) = old[i];
+            }
+        }
+        free(old);
+    }
+    struct tile_store_entry *entry = tile_store_find(store, key);
+    if (!entry->offset) {
+        store->count++;
+    }
+    entry->key = *key;
+    entry->mode = mode;
+    entry->offset = offset;
+}
+
+static void tile_store_remap(struct tile_store *store) {
+    if (store->map) {
+        munmap((void*)store->map, store->map_size);
+    }
+    store->map = NULL;
+    store->map_size = 0;
+    void *map = mmap(NULL, store->file_size, PROT_READ, MAP_SHARED, store->fd, 0);
+    if (map != MAP_FAILED) {
+        store->map = (const unsigned char*)map;
+        store->map_size = store->file_size;
+    }
+}
+
+
+struct tile_store *tile_store_open(const char *path, int width_px, int height_px) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct tile_store *store = (struct tile_store*)calloc(1, sizeof(*store));
+    store->fd = fd;
+    store->tile_len = width_px * height_px;
+    store->record_size = (sizeof(struct tile_record) + store->tile_len * sizeof(float) + 7) & ~(size_t)7;
+    store->capacity = TILE_STORE_INITIAL_CAPACITY;
+    store->entries = (struct tile_store_entry*)calloc(store->capacity, sizeof(store->entries[0]));
+    store->scratch = (unsigned char*)calloc(1, store->record_size);
+
+    struct tile_store_header expected = { TILE_STORE_MAGIC, TILE_STORE_VERSION, width_px, height_px, store->record_size, { 0 } };
+    struct tile_store_header header;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        tile_store_close(store);
+        return NULL;
+    }
+    store->file_size = st.st_size;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(&header, &expected, sizeof(header)) != 0) {
+        // New file, or written by another version or for another tile size
+        if (st.st_size > 0) {
+            fprintf(stderr, "Tile store %s is stale, starting over\n", path);
+        }
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, &expected, sizeof(expected), 0) != (ssize_t)sizeof(expected)) {
+            tile_store_close(store);
+            return NULL;
+        }
+        store->file_size = sizeof(expected);
+    }
+    // A torn last record (crash while appending) is cut off
+    off_t records = (store->file_size - (off_t)sizeof(header)) / store->record_size;
+    off_t whole = sizeof(header) + records * store->record_size;
+    if (whole != store->file_size && ftruncate(fd, whole) == 0) {
+        store->file_size = whole;
+    }
+    tile_store_remap(store);
+    if (!store->map) {
+        tile_store_close(store);
+        return NULL;
+    }
+    for (off_t offset = sizeof(header); offset + (off_t)store->record_size <= store->file_size; offset += store->record_size) {
+        const struct tile_record *record = (const struct tile_record*)(store->map + offset);
+        if (record->magic != TILE_RECORD_MAGIC) {
+            continue;
+        }
+        struct tile_key key = { record->anchor, record->level, record->x, record->y, record->depth };
+        tile_store_index(store, &key, record->mode, offset);
+    }
+    return store;
+}
+
+void tile_store_close(struct tile_store *store) {
+    if (store->map) {
+        munmap((void*)store->map, store->map_size);
+    }
+    close(store->fd);
+    free(store->entries);
+    free(store->scratch);
+    free(store);
+}
+
+const float *tile_store_lookup(struct tile_store *store, const struct tile_key *key, int mode) {
+    struct tile_store_entry *entry = tile_store_find(store, key);
+    if (!entry->offset || entry->mode != mode) {
+        return NULL;
+    }
+    // Appended since the last mapping
+    if (entry->offset + store->record_size > store->map_size) {
+        tile_store_remap(store);
+        if (entry->offset + store->record_size > store->map_size) {
+            return NULL;
+        }
+    }
+    const struct tile_record *record = (const struct tile_record*)(store->map + entry->offset);
+    if (record->magic != TILE_RECORD_MAGIC || record->anchor != key->anchor || record->level != key->level ||
+        record->x != key->x || record->y != key->y || record->depth != key->depth || record->mode != mode ||
+        record->checksum != tile_record_checksum(record, store->record_size)) {
+        entry->mode = -1;
+        return NULL;
+    }
+    return (const float*)(record + 1);
+}
+
+int tile_store_append(struct tile_store *store, const struct tile_key *key, int mode, const float *pixels) {
+    struct tile_record *record = (struct tile_record*)store->scratch;
+    record->magic = TILE_RECORD_MAGIC;
+    record->level = key->level;
+    record->anchor = key->anchor;
+    record->x = key->x;
+    record->y = key->y;
+    record->mode = mode;
+    record->depth = key->depth;
+    memcpy(record + 1, pixels, store->tile_len * sizeof(float));
+    record->checksum = tile_record_checksum(record, store->record_size);
+    if (pwrite(store->fd, record, store->record_size, store->file_size) != (ssize_t)store->record_size) {
+        return -1;
+    }
+    tile_store_index(store, key, mode, store->file_size);
+    store->file_size += store->record_size;
+    return 0;
+}
+
+int tile_store_count(const struct tile_store *store) {
+    return store->count;
+}
@@ -0,0 +1,41 @@
+#ifndef TILESTORE_H
+#define TILESTORE_H
+
+#include "tilecache.h"
+#include "mandelbrot.h"
+
+// On-disk store of computed tiles, so they survive restarts.
+// The file is a header followed by fixed size records (record header +
+// pixels), appended as tiles finish and memory-mapped on open; only the
+// record headers are read to build the index, pixels are read from the
+// mapping when a tile is asked for.
+//
+// Validity:
+//  - the file header carries a format version and the tile size; a file
+//    written with other values is stale and started over
+//  - the iteration depth is part of the tile key, tiles of several depths
+//    live side by side
+//  - a record carries the mode its tile was computed in (precision, or
+//    perturbation); asking for another mode is a miss, the tile is redone
+//  - a record carries a checksum of its key and pixels, checked on every
+//    lookup; a torn or corrupt record is a miss
+// A later record for the same key replaces the earlier one.
+
+#define TILE_STORE_VERSION 3 // 2: smooth escape values, 3: depth per record
+#define TILE_MODE_PERTURBED PRECISION_COUNT
+
+struct tile_store;
+
+// Opens or creates the store, NULL if the file cannot be used
+struct tile_store *tile_store_open(const char *path, int width_px, int height_px);
+void tile_store_close(struct tile_store *store);
+
+// Pixels of a valid tile, pointing into the mapping (valid until the next
+// call on the store), or NULL
+const float *tile_store_lookup(struct tile_store *store, const struct tile_key *key, int mode);
+// Returns 0 on success
+int tile_store_append(struct tile_store *store, const struct tile_key *key, int mode, const float *pixels);
+// Number of indexed tiles
+int tile_store_count(const struct tile_store *store);
+
+#endif
@@ -0,0 +1,221 @@
+// Prototypes of the GL 4.5 entry points, some of them return pointers
+#define GL_GLEXT_PROTOTYPES
+#include "upload.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define UPLOAD_MAP_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+// Blocks until the GPU is done with what the fence guards; frames earlier
+// than the last UPLOAD_FRAMES - 1 are usually long done
+static void upload_wait(GLsync *fence) {
+    if (!*fence) {
+        return;
+    }
+    while (glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(*fence);
+    *fence = 0;
+}
+
+static void upload_fence(GLsync *fence) {
+    if (*fence) {
+        glDeleteSync(*fence);
+    }
+    *fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+
+static int vertex_stream_create(struct vertex_stream *stream, int capacity) {
+    GLsizeiptr size = (GLsizeiptr)UPLOAD_FRAMES * capacity * stream->vertex_len * sizeof(GLdouble);
+    glCreateBuffers(1, &stream->buffer);
+    glNamedBufferStorage(stream->buffer, size, NULL, UPLOAD_MAP_FLAGS);
+    stream->mapped = (GLdouble*)glMapNamedBufferRange(stream->buffer, 0, size, UPLOAD_MAP_FLAGS);
+    for (int r = 0; r < UPLOAD_FRAMES; r++) {
+        int *dirty = (int*)realloc(stream->dirty[r], capacity * sizeof(dirty[0]));
+        if (!dirty) {
+            return -1;
+        }
+        stream->dirty[r] = dirty;
+        stream->dirty_count[r] = 0;
+        stream->dirty_all[r] = 1;
+    }
+    stream->capacity = capacity;
+    return stream->mapped ? 0 : -1;
+}
+
+int vertex_stream_init(struct vertex_stream *stream, int vertex_len, int capacity) {
+    memset(stream, 0, sizeof(*stream));
+    stream->vertex_len = vertex_len;
+    return vertex_stream_create(stream, capacity);
+}
+
+void vertex_stream_release(struct vertex_stream *stream) {
+    for (int r = 0; r < UPLOAD_FRAMES; r++) {
+        upload_wait(&stream->fences[r]);
+        free(stream->dirty[r]);
+    }
+    if (stream->mapped) {
+        glUnmapNamedBuffer(stream->buffer);
+    }
+    glDeleteBuffers(1, &stream->buffer);
+    memset(stream, 0, sizeof(*stream));
+}
+
+int vertex_stream_reserve(struct vertex_stream *stream, int capacity) {
+    if (capacity <= stream->capacity) {
+        return 0;
+    }
+    // Frames in flight keep reading the old buffer, GL deletes it after them
+    if (stream->mapped) {
+        glUnmapNamedBuffer(stream->buffer);
+    }
+    glDeleteBuffers(1, &stream->buffer);
+    stream->mapped = NULL;
+    for (int r = 0; r < UPLOAD_FRAMES; r++) {
+        if (stream->fences[r]) {
+            glDeleteSync(stream->fences[r]);
+            stream->fences[r] = 0;
+        }
+    }
+    if (vertex_stream_create(stream, capacity) != 0) {
+        return -1;
+    }
+    return 1;
+}
+
+void vertex_stream_changed(struct vertex_stream *stream, int vertex) {
+    int r = stream->region;
+    if (stream->dirty_all[r]) {
+        return;
+    }
+    if (stream->dirty_count[r] == stream->capacity) {
+        stream->dirty_all[r] = 1;
+        return;
+    }
+    stream->dirty[r][stream->dirty_count[r]++] = vertex;
+}
+
+void vertex_stream_changed_all(struct vertex_stream *stream) {
+    stream->dirty_all[stream->region] = 1;
+}
+
+GLint vertex_stream_flush(struct vertex_stream *stream, const GLdouble *data, int count) {
+    int region = stream->region;
+    GLint first = region * stream->capacity;
+    if (!stream->mapped) {
+        return first;
+    }
+    GLdouble *copy = stream->mapped + (size_t)first * stream->vertex_len;
+    size_t vertex_bytes = stream->vertex_len * sizeof(GLdouble);
+    // The copy missed the changes of the frames since it was last written,
+    // and those of this one: the changes of every frame in flight
+    int all = 0;
+    for (int r = 0; r < UPLOAD_FRAMES; r++) {
+        all |= stream->dirty_all[r];
+    }
+    if (all) {
+        memcpy(copy, data, count * vertex_bytes);
+        return first;
+    }
+    for (int r = 0; r < UPLOAD_FRAMES; r++) {
+        for (int k = 0; k < stream->dirty_count[r]; k++) {
+            int v = stream->dirty[r][k];
+            if (v < count) {
+                memcpy(copy + (size_t)v * stream->vertex_len, data + (size_t)v * stream->vertex_len, vertex_bytes);
+            }
+        }
+    }
+    return first;
+}
+
+void vertex_stream_fence(struct vertex_stream *stream) {
+    upload_fence(&stream->fences[stream->region]);
+    stream->region = (stream->region + 1) % UPLOAD_FRAMES;
+    upload_wait(&stream->fences[stream->region]);
+    stream->dirty_count[stream->region] = 0;
+    stream->dirty_all[stream->region] = 0;
+}
+
+
+int texture_stream_init(struct texture_stream *stream, GLuint texture, int width_px, int height_px,
+        GLenum format, GLenum type, size_t pixel_bytes, int chunks) {
+    memset(stream, 0, sizeof(*stream));
+    stream->texture = texture;
+    stream->width_px = width_px;
+    stream->height_px = height_px;
+    stream->format = format;
+    stream->type = type;
+    stream->chunk_bytes = (size_t)width_px * height_px * pixel_bytes;
+    stream->chunks = chunks;
+    stream->layers = (int*)malloc(chunks * sizeof(stream->layers[0]));
+    GLsizeiptr size = (GLsizeiptr)(UPLOAD_FRAMES * chunks * stream->chunk_bytes);
+    glCreateBuffers(1, &stream->buffer);
+    glNamedBufferStorage(stream->buffer, size, NULL, UPLOAD_MAP_FLAGS);
+    stream->mapped = (unsigned char*)glMapNamedBufferRange(stream->buffer, 0, size, UPLOAD_MAP_FLAGS);
+    return stream->mapped && stream->layers ? 0 : -1;
+}
+
+void texture_stream_release(struct texture_stream *stream) {
+    for (int s = 0; s < UPLOAD_FRAMES; s++) {
+        upload_wait(&stream->fences[s]);
+    }
+    if (stream->mapped) {
+        glUnmapNamedBuffer(stream->buffer);
+    }
+    glDeleteBuffers(1, &stream->buffer);
+    free(stream->layers);
+    memset(stream, 0, sizeof(*stream));
+}
+
+void *texture_stream_slot(struct texture_stream *stream, int layer) {
+    if (!stream->mapped || stream->used == stream->chunks) {
+        return NULL;
+    }
+    size_t slot = (size_t)stream->segment * stream->chunks + stream->used;
+    stream->layers[stream->used++] = layer;
+    return stream->mapped + slot * stream->chunk_bytes;
+}
+
+void texture_stream_upload(struct texture_stream *stream, int layer, const void *pixels) {
+    void *slot = texture_stream_slot(stream, layer);
+    if (slot) {
+        memcpy(slot, pixels, stream->chunk_bytes);
+        return;
+    }
+    // Out of staging space: straight from client memory, after what is
+    // queued for the same layers
+    texture_stream_flush(stream);
+    glTextureSubImage3D(stream->texture, 0, 0, 0, layer, stream->width_px, stream->height_px, 1,
+            stream->format, stream->type, pixels);
+}
+
+void texture_stream_flush(struct texture_stream *stream) {
+    if (stream->flushed == stream->used) {
+        return;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->buffer);
+    // Slots going to consecutive layers are one copy
+    for (int k = stream->flushed; k < stream->used; ) {
+        int n = 1;
+        while (k + n < stream->used && stream->layers[k + n] == stream->layers[k] + n) {
+            n++;
+        }
+        size_t offset = ((size_t)stream->segment * stream->chunks + k) * stream->chunk_bytes;
+        glTextureSubImage3D(stream->texture, 0, 0, 0, stream->layers[k], stream->width_px, stream->height_px, n,
+                stream->format, stream->type, (const void*)offset);
+        k += n;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    stream->flushed = stream->used;
+}
+
+void texture_stream_fence(struct texture_stream *stream) {
+    texture_stream_flush(stream);
+    upload_fence(&stream->fences[stream->segment]);
+    stream->segment = (stream->segment + 1) % UPLOAD_FRAMES;
+    upload_wait(&stream->fences[stream->segment]);
+    stream->used = 0;
+    stream->flushed = 0;
+}
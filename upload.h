@@ -0,0 +1,79 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+// Streaming uploads of the render loop, without stalls or reallocations.
+// Both streams write into persistently mapped, coherent buffers: the CPU
+// writes one part of the buffer per frame while the GPU may still read the
+// parts of the UPLOAD_FRAMES - 1 frames before it. A fence placed after each
+// frame's draw guards a part until the GPU is done with it.
+//
+// The vertex stream holds UPLOAD_FRAMES copies of the vertex array and only
+// rewrites the vertices that changed since the copy was last written. The
+// texture stream stages chunk pixels in a pixel unpack buffer, and copies
+// them to their layers in one batch per frame.
+
+#include <stddef.h>
+#include <GL/gl.h>
+
+#define UPLOAD_FRAMES 3
+
+struct vertex_stream {
+    GLuint buffer;
+    GLdouble *mapped;
+    int vertex_len;         // values per vertex
+    int capacity;           // vertices per copy
+    int region;             // copy written in this frame
+    GLsync fences[UPLOAD_FRAMES];
+    // Vertices changed in the frame that last wrote each copy
+    int *dirty[UPLOAD_FRAMES];
+    int dirty_count[UPLOAD_FRAMES];
+    int dirty_all[UPLOAD_FRAMES];
+};
+
+struct texture_stream {
+    GLuint buffer;
+    unsigned char *mapped;
+    GLuint texture;
+    int width_px;
+    int height_px;
+    GLenum format;
+    GLenum type;
+    size_t chunk_bytes;
+    int chunks;             // staging slots per frame
+    int segment;            // slots written in this frame
+    GLsync fences[UPLOAD_FRAMES];
+    int *layers;            // destination of each slot of the segment
+    int used;
+    int flushed;            // slots already copied to the texture
+};
+
+// Returns 0 on success
+int vertex_stream_init(struct vertex_stream *stream, int vertex_len, int capacity);
+void vertex_stream_release(struct vertex_stream *stream);
+// Grows every copy to `capacity` vertices. The buffer storage is immutable,
+// so that is a new buffer: returns 1 when the caller has to bind it again,
+// -1 when it can not be mapped
+int vertex_stream_reserve(struct vertex_stream *stream, int capacity);
+void vertex_stream_changed(struct vertex_stream *stream, int vertex);
+void vertex_stream_changed_all(struct vertex_stream *stream);
+// Brings this frame's copy up to date with the first `count` vertices of
+// `data`, returns the index of its first vertex, for glDrawArrays
+GLint vertex_stream_flush(struct vertex_stream *stream, const GLdouble *data, int count);
+// After the draw: fences this frame's copy and moves on to the next one
+void vertex_stream_fence(struct vertex_stream *stream);
+
+// `chunks` pixel rects of width_px x height_px per frame, larger frames fall
+// back to direct uploads. Returns 0 on success
+int texture_stream_init(struct texture_stream *stream, GLuint texture, int width_px, int height_px,
+        GLenum format, GLenum type, size_t pixel_bytes, int chunks);
+void texture_stream_release(struct texture_stream *stream);
+// Staging memory for the pixels of `layer`, which the next flush copies to
+// the texture. NULL once the slots of this frame are used up
+void *texture_stream_slot(struct texture_stream *stream, int layer);
+// Copies the pixels, to a slot or, if there is none, straight to the layer
+void texture_stream_upload(struct texture_stream *stream, int layer, const void *pixels);
+// Issues the copies to the texture
+void texture_stream_flush(struct texture_stream *stream);
+void texture_stream_fence(struct texture_stream *stream);
+
+#endif